@@ -20,12 +20,17 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include "libcgo.h"
 
 /* some "configuration" */
 #define START_URI           "gopher://gopher.floodgap.com:70"
@@ -36,14 +41,47 @@
 #define CMD_TELNET          "telnet"
 #define COLOR_PROMPT        "1;34"
 #define COLOR_SELECTOR      "1;32"
-#define HEAD_CHECK_LEN      5
 #define GLOBAL_CONFIG_FILE  "/etc/cgorc"
 #define LOCAL_CONFIG_FILE   "/.cgorc"
 #define NUM_BOOKMARKS       20
+#define NUM_SEARCHES        10
+#define NUM_TABS            9
+#define SEARCH_TIMEOUT      "10"
+#define SEARCH_TTL          "120"
+#define SEARCH_CACHE_LEN    16
+#define WATCHLIST_FILE      "/.cgowatch"
+#define WATCH_STATE_SUFFIX  ".state"
+#define WATCH_INTERVAL      "1800"
+#define WATCH_DELAY         "2"
+#define BULK_TYPES          "Igp"
+#define BULK_MAX            "4"
+#define PRECONNECT          "true"
+#define PROXY_TTL           "300"
+#define PROXY_CACHE         "65536"
+#define PROXY_PORTS         "70"
+#define TAB_MEMORY          "256"
 #define VERBOSE             "true"
 
 /* some internal defines */
 #define KEY_RANGE   	(('z' - 'a') + 1)
+#define WARM_MAX            3
+#define WARM_PER_HOST       2
+#define WARM_TTL            20000
+#define WATCH_MAX_ACTIVE    64
+#define WATCH_TIMEOUT       30000
+#define WATCH_SAVE_INTERVAL 60000
+#define WATCH_MAX_LINKS     (KEY_RANGE * KEY_RANGE)
+#define PROXY_MAX_CLIENTS   256
+#define PROXY_BUCKETS       1024
+#define PROXY_TIMEOUT       30000
+#define PROXY_MAX_ENTRY     (8 * 1024 * 1024)
+#define PROXY_MAX_HOSTS     256
+#define PROXY_DNS_TTL       300000
+#define BULK_TIMEOUT        30000
+#define EXPORT_MAX          10000
+#define EXPORT_BUCKETS      4096
+#define EXPORT_TIMEOUT      30000
+#define TAB_TIMEOUT         60000
 
 /* structs */
 typedef struct link_s link_t;
@@ -66,6 +104,109 @@ struct config_s {
     char    color_prompt[512];
     char    color_selector[512];
     char    verbose[512];
+    char    search_timeout[512];
+    char    search_ttl[512];
+    char    watchlist[512];
+    char    watch_interval[512];
+    char    watch_delay[512];
+    char    bulk_max[512];
+    char    preconnect[512];
+    char    proxy[512];
+    char    proxy_upstream[512];
+    char    proxy_ttl[512];
+    char    proxy_cache[512];
+    char    proxy_ports[512];
+    char    tab_memory[512];
+};
+
+typedef struct warm_s warm_t;
+struct warm_s {
+    int     used, ready;
+    int     fd;
+    char    host[512], port[64];
+    long    started, connected;
+};
+
+typedef struct watch_s watch_t;
+struct watch_s {
+    char                *uri;
+    char                type;
+    char                *host, *port, *selector;
+    int                 host_index, slot, known, polled;
+    long                last, next;
+    unsigned long long  hash, *lines;
+    size_t              num_lines;
+};
+
+typedef struct watch_host_s watch_host_t;
+struct watch_host_s {
+    const char  *name;
+    int         busy;
+    long        next;
+};
+
+typedef struct proxy_host_s proxy_host_t;
+struct proxy_host_s {
+    char    host[512], port[64];
+    char    addr[64];       /* numeric, empty if unknown */
+    long    expires;
+    int     resolving;
+};
+
+typedef struct proxy_dns_s proxy_dns_t;
+struct proxy_dns_s {
+    proxy_host_t    *host;
+    char            name[512], port[64], addr[64];
+    int             fd;         /* where the resolver reports back */
+};
+
+typedef struct proxy_entry_s proxy_entry_t;
+struct proxy_entry_s {
+    proxy_entry_t   *next;
+    char            *key;
+    cgo_fetch_t     fetch;
+    size_t          base;       /* bytes already dropped from fetch.data */
+    long            expires, used;
+    int             refs, cached;
+    proxy_host_t    *resolving; /* waiting for the address of this host */
+};
+
+typedef struct proxy_client_s proxy_client_t;
+struct proxy_client_s {
+    int             fd;
+    char            request[1024];
+    size_t          len, sent;
+    long            deadline;
+    proxy_entry_t   *entry;
+};
+
+typedef struct export_s export_t;
+struct export_s {
+    char    type;
+    char    *selector;
+    int     next;       /* in the same bucket */
+};
+
+typedef struct tab_s tab_t;
+struct tab_s {
+    char        name[32];           /* empty if unused */
+    link_t      *links, *history;   /* the current tab keeps them in the globals */
+    int         link_key;
+    char        host[512], port[64], selector[1024];
+    char        *page;              /* menu lines to redraw from */
+    size_t      page_len, page_cap;
+    int         loading;
+    cgo_fetch_t fetch;
+    char        load_host[512], load_port[64], load_selector[1024];
+};
+
+typedef struct search_s search_t;
+struct search_s {
+    search_t    *next;
+    char        *query;
+    char        *data;
+    size_t      len;
+    long        time;
 };
 
 char        tmpfilename[256];
@@ -75,16 +216,34 @@ int         link_key;
 char        current_host[512], current_port[64], current_selector[1024];
 char        parsed_host[512], parsed_port[64], parsed_selector[1024];
 char        bookmarks[NUM_BOOKMARKS][512];
+char        searches[NUM_SEARCHES][512];
+warm_t      warm[WARM_MAX];
+search_t    *search_cache = NULL;
+char        proxy_upstream_host[512], proxy_upstream_port[64];
+proxy_entry_t *proxy_cache[PROXY_BUCKETS];
+long        proxy_cache_size = 0;
+proxy_host_t proxy_hosts[PROXY_MAX_HOSTS];
+int         proxy_dns_fds[2];
 config_t    config;
+cgo_ctx_t   ctx;
+cgo_archive_t archive;  /* mapped with -A */
+tab_t       tabs[NUM_TABS];
+int         tab_current = 0;
 
 /* function prototypes */
 int parse_uri(const char *uri);
+int follow_link(int key);
+int warm_take(const char *host, const char *port);
+void view_stream(int kind, cgo_reader_t *r, const char *selector);
+void print_prompt();
+int tab_check();
+void page_add(tab_t *t, const char *line);
 
 /* implementation */
 void usage()
 {
-    fputs("usage: cgo [-v] [-H] [gopher URI]\n",
-            stderr);
+    fputs("usage: cgo [-v] [-H] [-w watchlist] [-P [host]:port] [-A archive]\n"
+            "           [gopher URI]\n", stderr);
     exit(EXIT_SUCCESS);
 }
 
@@ -118,6 +277,19 @@ void parse_config_line(const char *line)
     else if (! strcmp(token, "color_prompt")) value = &config.color_prompt[0];
     else if (! strcmp(token, "color_selector")) value = &config.color_selector[0];
     else if (! strcmp(token, "verbose")) value = &config.verbose[0];
+    else if (! strcmp(token, "search_timeout")) value = &config.search_timeout[0];
+    else if (! strcmp(token, "search_ttl")) value = &config.search_ttl[0];
+    else if (! strcmp(token, "watchlist")) value = &config.watchlist[0];
+    else if (! strcmp(token, "watch_interval")) value = &config.watch_interval[0];
+    else if (! strcmp(token, "watch_delay")) value = &config.watch_delay[0];
+    else if (! strcmp(token, "bulk_max")) value = &config.bulk_max[0];
+    else if (! strcmp(token, "preconnect")) value = &config.preconnect[0];
+    else if (! strcmp(token, "proxy")) value = &config.proxy[0];
+    else if (! strcmp(token, "proxy_upstream")) value = &config.proxy_upstream[0];
+    else if (! strcmp(token, "proxy_ttl")) value = &config.proxy_ttl[0];
+    else if (! strcmp(token, "proxy_cache")) value = &config.proxy_cache[0];
+    else if (! strcmp(token, "proxy_ports")) value = &config.proxy_ports[0];
+    else if (! strcmp(token, "tab_memory")) value = &config.tab_memory[0];
     else {
         for (j = 0; j < NUM_BOOKMARKS; j++) {
             snprintf(bkey, sizeof(bkey), "bookmark%d", j+1);
@@ -126,6 +298,13 @@ void parse_config_line(const char *line)
                 break;
             }
         }
+        for (j = 0; ! value && j < NUM_SEARCHES; j++) {
+            snprintf(bkey, sizeof(bkey), "search%d", j+1);
+            if (! strcmp(token, bkey)) {
+                value = &searches[j][0];
+                break;
+            }
+        }
         if (! value) return;
     };
 
@@ -192,7 +371,20 @@ void init_config()
     snprintf(config.color_prompt, sizeof(config.color_prompt), "%s", COLOR_PROMPT);
     snprintf(config.color_selector, sizeof(config.color_selector), "%s", COLOR_SELECTOR);
     snprintf(config.verbose, sizeof(config.verbose), "%s", VERBOSE);
+    snprintf(config.search_timeout, sizeof(config.search_timeout), "%s", SEARCH_TIMEOUT);
+    snprintf(config.search_ttl, sizeof(config.search_ttl), "%s", SEARCH_TTL);
+    config.watchlist[0] = 0;
+    snprintf(config.watch_interval, sizeof(config.watch_interval), "%s", WATCH_INTERVAL);
+    snprintf(config.watch_delay, sizeof(config.watch_delay), "%s", WATCH_DELAY);
+    snprintf(config.bulk_max, sizeof(config.bulk_max), "%s", BULK_MAX);
+    snprintf(config.preconnect, sizeof(config.preconnect), "%s", PRECONNECT);
+    config.proxy[0] = config.proxy_upstream[0] = 0;
+    snprintf(config.proxy_ttl, sizeof(config.proxy_ttl), "%s", PROXY_TTL);
+    snprintf(config.proxy_cache, sizeof(config.proxy_cache), "%s", PROXY_CACHE);
+    snprintf(config.proxy_ports, sizeof(config.proxy_ports), "%s", PROXY_PORTS);
+    snprintf(config.tab_memory, sizeof(config.tab_memory), "%s", TAB_MEMORY);
     for (i = 0; i < NUM_BOOKMARKS; i++) bookmarks[i][0] = 0;
+    for (i = 0; i < NUM_SEARCHES; i++) searches[i][0] = 0;
     /* read configs */
     load_config(GLOBAL_CONFIG_FILE);
     home = getenv("HOME");
@@ -200,42 +392,30 @@ void init_config()
         snprintf(filename, sizeof(filename), "%s%s", home, LOCAL_CONFIG_FILE);
         load_config(filename);
     }
+    /* split proxy addresses once */
+    cgo_init(&ctx);
+    if (! cgo_set_proxy(&ctx, config.proxy))
+        fprintf(stderr, "error: %s\n", ctx.error);
+    if (config.proxy_upstream[0] && parse_uri(config.proxy_upstream)) {
+        snprintf(proxy_upstream_host, sizeof(proxy_upstream_host), "%s", parsed_host);
+        snprintf(proxy_upstream_port, sizeof(proxy_upstream_port), "%s", parsed_port);
+    }
 }
 
 int dial(const char *host, const char *port, const char *selector)
 {
-    struct addrinfo hints;
-    struct addrinfo *res, *r;
-    int             srv = -1, l;
-    char            request[512];
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    if (getaddrinfo(host, port, &hints, &res) != 0) {
-        fprintf(stderr, "error: cannot resolve hostname '%s:%s': %s\n",
-                host, port, strerror(errno));
-        return -1;
-    }
-    for (r = res; r; r = r->ai_next) {
-        srv = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
-        if (srv == -1)
-            continue;
-        if (connect(srv, r->ai_addr, r->ai_addrlen) == 0)
-            break;
-        close(srv);
-    }
-    freeaddrinfo(res);
-    if (! r) {
-        fprintf(stderr, "error: cannot connect to host '%s:%s'\n",
-                host, port);
-        return -1;
-    }
-    snprintf(request, sizeof(request), "%s\r\n", selector);
-    l = strlen(request);
-    if (write(srv, request, l) != l) {
-        fprintf(stderr, "error: cannot complete request\n");
-        close(srv);
+    int     srv;
+    char    routed[1100];
+
+    selector = cgo_route(&ctx, &host, &port, selector, routed, sizeof(routed));
+    /* prefer a connection opened while the user was typing */
+    srv = warm_take(host, port);
+    if (srv == -1)
+        srv = cgo_connect(&ctx, host, port);
+    if (srv == -1 || ! cgo_request(&ctx, srv, selector)) {
+        fprintf(stderr, "error: %s\n", ctx.error);
+        if (srv != -1)
+            close(srv);
         return -1;
     }
     return srv;
@@ -256,35 +436,226 @@ int read_line(int fd, char *buf, size_t buf_len)
     return 1;
 }
 
-int download_file(const char *host, const char *port,
+void warm_close(warm_t *w)
+{
+    close(w->fd);
+    w->used = 0;
+}
+
+void warm_check()
+{
+    struct pollfd   pfd;
+    long            now = cgo_now_ms();
+    int             i;
+
+    for (i = 0; i < WARM_MAX; i++) {
+        if (! warm[i].used)
+            continue;
+        if (! warm[i].ready) {
+            if (now - warm[i].started > WARM_TTL)
+                warm_close(&warm[i]);
+            continue;
+        }
+        /* retire old sockets and those closed by the server */
+        pfd.fd = warm[i].fd;
+        pfd.events = POLLIN;
+        if (now - warm[i].connected > WARM_TTL || poll(&pfd, 1, 0) != 0)
+            warm_close(&warm[i]);
+    }
+}
+
+void warm_start(const char *host, const char *port, int want)
+{
+    int     i, n;
+
+    cgo_route(&ctx, &host, &port, "", NULL, 0);
+    for (i = 0, n = 0; i < WARM_MAX; i++)
+        if (warm[i].used && ! strcmp(warm[i].host, host) && ! strcmp(warm[i].port, port))
+            n++;
+    for (i = 0; i < WARM_MAX && n < want; i++) {
+        if (warm[i].used)
+            continue;
+        warm[i].fd = cgo_dial_start(host, port);
+        if (warm[i].fd == -1)
+            return;
+        fcntl(warm[i].fd, F_SETFD, FD_CLOEXEC);    /* not for our viewers */
+        snprintf(warm[i].host, sizeof(warm[i].host), "%s", host);
+        snprintf(warm[i].port, sizeof(warm[i].port), "%s", port);
+        warm[i].started = cgo_now_ms();
+        warm[i].ready = 0;
+        warm[i].used = 1;
+        n++;
+    }
+}
+
+void warm_up()
+{
+    link_t  *link, *other, *best = NULL;
+    int     count, best_count = 0;
+
+    if (! check_option_true(config.preconnect) || archive.map)
+        return;
+    warm_check();
+    warm_start(current_host, current_port, WARM_PER_HOST);
+    /* and the host most links point to */
+    for (link = links; link; link = link->next) {
+        if (link->which == '8' || (! strcmp(link->host, current_host) &&
+                    ! strcmp(link->port, current_port)))
+            continue;
+        for (other = links, count = 0; other; other = other->next)
+            if (! strcmp(other->host, link->host) && ! strcmp(other->port, link->port))
+                count++;
+        if (count > best_count) {
+            best = link;
+            best_count = count;
+        }
+    }
+    if (best)
+        warm_start(best->host, best->port, 1);
+}
+
+int warm_take(const char *host, const char *port)
+{
+    struct pollfd   pfd;
+    long            now = cgo_now_ms(), wait;
+    int             i, err = 0;
+    socklen_t       err_len = sizeof(err);
+
+    for (i = 0; i < WARM_MAX; i++) {
+        if (! warm[i].used || strcmp(warm[i].host, host) || strcmp(warm[i].port, port))
+            continue;
+        warm[i].used = 0;
+        pfd.fd = warm[i].fd;
+        if (! warm[i].ready) {
+            /* still connecting, which is better than starting over - for a while */
+            wait = warm[i].started + WARM_TTL - now;
+            if (ctx.timeout > 0 && wait > ctx.timeout)
+                wait = ctx.timeout;
+            pfd.events = POLLOUT;
+            if (wait <= 0 || poll(&pfd, 1, wait) != 1 ||
+                    getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err) {
+                close(pfd.fd);
+                continue;
+            }
+            warm[i].connected = cgo_now_ms();
+        }
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) != 0) {
+            close(pfd.fd);  /* closed by the server meanwhile */
+            continue;
+        }
+        fcntl(pfd.fd, F_SETFL, fcntl(pfd.fd, F_GETFL) & ~O_NONBLOCK);
+        if (check_option_true(config.verbose))
+            printf("(warm connection, saved %ld ms handshake)\n",
+                    (warm[i].connected < now ? warm[i].connected : now) - warm[i].started);
+        return pfd.fd;
+    }
+    return -1;
+}
+
+int read_prompt(char *line, size_t line_len)
+{
+    struct pollfd   pfds[1 + WARM_MAX + NUM_TABS];
+    int             i, used, err;
+    socklen_t       err_len;
+
+    for (;;) {
+        /* finish handshakes and background tabs while the user is typing */
+        pfds[0].fd = 0;
+        pfds[0].events = POLLIN;
+        for (i = 0, used = 0; i < WARM_MAX; i++) {
+            pfds[1 + i].fd = warm[i].used && ! warm[i].ready ? warm[i].fd : -1;
+            pfds[1 + i].events = POLLOUT;
+            used |= warm[i].used;
+        }
+        for (i = 0; i < NUM_TABS; i++) {
+            pfds[1 + WARM_MAX + i].fd = -1;
+            if (tabs[i].loading)
+                cgo_fetch_pollfd(&tabs[i].fetch, &pfds[1 + WARM_MAX + i]);
+            used |= tabs[i].loading;
+        }
+        if (poll(pfds, 1 + WARM_MAX + NUM_TABS, used ? 1000 : -1) == -1 && errno != EINTR)
+            return read_line(0, line, line_len);
+        for (i = 0; i < NUM_TABS; i++)
+            if (tabs[i].loading)
+                cgo_fetch_handle(&tabs[i].fetch, pfds[1 + WARM_MAX + i].revents);
+        if (tab_check())
+            print_prompt();
+        for (i = 0; i < WARM_MAX; i++) {
+            if (pfds[1 + i].fd == -1 || ! pfds[1 + i].revents)
+                continue;
+            err = 0;
+            err_len = sizeof(err);
+            if (getsockopt(warm[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err) {
+                warm_close(&warm[i]);
+                continue;
+            }
+            warm[i].ready = 1;
+            warm[i].connected = cgo_now_ms();
+        }
+        warm_check();
+        if (pfds[0].revents)
+            return read_line(0, line, line_len);
+    }
+}
+
+int copy_file(int srvfd, const char *head, size_t head_len,
         const char *selector, int fd)
 {
-    int             srvfd, len;
-    unsigned long   total = 0;
+    int             len = 0, err = 0;
+    unsigned long   total = head_len;
     char            buffer[4096];
 
-    if (check_option_true(config.verbose))
-        printf("downloading [%s]...\r", selector);
-    srvfd = dial(host, port, selector);
-    if (srvfd == -1) {
-        printf("\033[2Kerror: downloading [%s] failed\n", selector);
-        close(fd);
-        return 0;
-    }
-    while ((len = read(srvfd, buffer, sizeof(buffer))) > 0) {
+    if (head_len > 0)
+        write(fd, head, head_len);
+    while (srvfd != -1 && (len = read(srvfd, buffer, sizeof(buffer))) > 0) {
         write(fd, buffer, len);
         total += len;
         if (check_option_true(config.verbose))
             printf("downloading [%s] (%ld kb)...\r", selector, total / 1024);
     }
+    if (len < 0)
+        err = errno;
     close(fd);
-    close(srvfd);
+    if (srvfd != -1)
+        close(srvfd);
+    if (err) {
+        printf("\033[2Kerror: downloading [%s] stopped: %s\n", selector,
+                err == EAGAIN || err == EWOULDBLOCK ? "timed out" : strerror(err));
+        return 0;
+    }
     if (check_option_true(config.verbose))
         printf("\033[2Kdownloading [%s] complete\n", selector);
     return 1;
 }
 
-int download_temp(const char *host, const char *port, const char *selector)
+int download_file(const char *host, const char *port,
+        const char *selector, int fd)
+{
+    int         srvfd;
+    const char  *data;
+    size_t      len;
+
+    if (archive.map) {
+        if (! cgo_archive_lookup(&archive, host, port, selector, NULL, &data, &len)) {
+            printf("error: [%s] is not in the archive\n", selector);
+            close(fd);
+            return 0;
+        }
+        return copy_file(-1, data, len, selector, fd);
+    }
+    if (check_option_true(config.verbose))
+        printf("downloading [%s]...\r", selector);
+    srvfd = dial(host, port, selector);
+    if (srvfd == -1) {
+        printf("\033[2Kerror: downloading [%s] failed\n", selector);
+        close(fd);
+        return 0;
+    }
+    return copy_file(srvfd, NULL, 0, selector, fd);
+}
+
+int make_temp()
 {
     int     tmpfd;
 
@@ -294,10 +665,18 @@ int download_temp(const char *host, const char *port, const char *selector)
     strcpy(tmpfilename, "/tmp/cgoXXXXXX");
 #endif
     tmpfd = mkstemp(tmpfilename);
-    if (tmpfd == -1) {
+    if (tmpfd == -1)
         fputs("error: unable to create tmp file\n", stderr);
+    return tmpfd;
+}
+
+int download_temp(const char *host, const char *port, const char *selector)
+{
+    int     tmpfd;
+
+    tmpfd = make_temp();
+    if (tmpfd == -1)
         return 0;
-    }
     if (! download_file(host, port, selector, tmpfd)) {
         unlink(tmpfilename);
         return 0;
@@ -353,58 +732,68 @@ void add_link(char which, const char *name,
             config.color_selector, a, b, c, name);
 }
 
-void clear_links()
+link_t *find_link(const char *host, const char *port, const char *selector)
+{
+    link_t  *link;
+
+    for (link = links; link; link = link->next) {
+        if (! strcmp(link->selector, selector) &&
+                ! strcmp(link->host, host) && ! strcmp(link->port, port))
+            return link;
+    }
+    return NULL;
+}
+
+void free_links(link_t *link)
 {
-    link_t  *link, *next;
+    link_t  *next;
 
-    for (link = links; link; ) {
+    for (; link; link = next) {
         next = link->next;
         free(link->host);
         free(link->port);
         free(link->selector);
         free(link);
-        link = next;
     }
+}
+
+void clear_links()
+{
+    free_links(links);
     links = NULL;
     link_key = 0;
+    /* the page no longer matches the links */
+    free(tabs[tab_current].page);
+    tabs[tab_current].page = NULL;
+    tabs[tab_current].page_len = tabs[tab_current].page_cap = 0;
 }
 
-void add_history()
+void push_history(link_t **list, const char *host, const char *port,
+        const char *selector)
 {
     link_t  *link;
 
     link = calloc(1, sizeof(link_t));
-    link->host = strdup(current_host);
-    link->port = strdup(current_port);
-    link->selector = strdup(current_selector);
+    link->host = strdup(host);
+    link->port = strdup(port);
+    link->selector = strdup(selector);
     link->which = 0;    /* not needed for history...just clear them */
     link->key = 0;
-    if (! history)
-        link->next = NULL;
-    else
-        link->next = history;
-    history = link;
+    link->next = *list;
+    *list = link;
+}
+
+void add_history()
+{
+    push_history(&history, current_host, current_port, current_selector);
 }
 
 void handle_directory_line(char *line)
 {
-    int     i;
-    char    *lp, *last, *fields[4];
+    char    *fields[4];
 
     /* tokenize */
-    for (i = 0; i < 4; i++)
-        fields[i] = NULL;
-    last = &line[1];
-    for (lp = last, i = 0; i < 4; lp++) {
-        if (*lp == '\t' || *lp == '\0') {
-            fields[i] = last;
-            last = lp + 1;
-            if (*lp == '\0')
-                break;
-            *lp = '\0';
-            i++;
-        }
-    }
+    cgo_split_item(line, fields);
     /* determine listing type */
     switch (line[0]) {
         case 'i':
@@ -433,92 +822,78 @@ void handle_directory_line(char *line)
     }
 }
 
-int is_valid_directory_entry(const char *line)
-{
-    switch (line[0]) {
-        case 'i':
-        case '3':
-        case '.':   /* some gopher servers use this */
-        case '0':
-        case '1':
-        case '5':
-        case '7':
-        case '8':
-        case '9':
-        case 'g':
-        case 'I':
-        case 'p':
-        case 'h':
-        case 's':
-            return 1;
-        default:
-            return 0;
-    }
-}
-
 void view_directory(const char *host, const char *port,
         const char *selector, int make_current)
 {
-    int     is_dir;
-    int     srvfd, i, head_read;
-    char    line[1024];
-    char    head[HEAD_CHECK_LEN][1024];
-
-    srvfd = dial(host, port, selector);
-    if (srvfd != -1) {  /* only adapt current prompt when successful */
-        /* make history entry */
-        if (make_current)
-            add_history();
-        /* don't overwrite the current_* things... */
-        if (host != current_host)
-            snprintf(current_host, sizeof(current_host), "%s", host);
-        if (port != current_port)
-            snprintf(current_port, sizeof(current_port), "%s", port);
-        if (selector != current_selector)
-            snprintf(current_selector, sizeof(current_selector),
-                    "%s", selector);
-    }
-    clear_links();  /* clear links *AFTER* dialing out!! */
-    if (srvfd == -1)
-        return; /* quit if not successful */
-    head_read = 0;
-    is_dir = 1;
-    while (head_read < HEAD_CHECK_LEN && read_line(srvfd, line, sizeof(line))) {
-        strcpy(head[head_read], line);
-        if (!is_valid_directory_entry(head[head_read])) {
-            is_dir = 0;
-            break;
+    int             srvfd = -1, kind;
+    char            line[1024];
+    const char      *data;
+    size_t          len;
+    cgo_reader_t    r;
+
+    if (archive.map) {
+        /* offline: keep the current links on a miss */
+        if (! cgo_archive_lookup(&archive, host, port, selector, NULL, &data, &len)) {
+            printf("(not in archive: %s:%s%s)\n", host, port, selector);
+            return;
+        }
+        cgo_reader_memory(&r, data, len);
+    } else {
+        srvfd = dial(host, port, selector);
+        if (srvfd == -1) {
+            clear_links();
+            return; /* quit if not successful */
         }
-        head_read++;
+        cgo_reader_init(&r, srvfd);
     }
-    if (!is_dir) {
-        puts("error: Not a directory.");
+    /* have a look at the first lines */
+    cgo_reader_head(&r);
+    if (r.failed && r.len == 0) {
+        printf("error: no answer from %s:%s\n", host, port);
         close(srvfd);
         return;
     }
-    for (i = 0; i < head_read; i++) {
-        handle_directory_line(head[i]);
+    kind = cgo_sniff(r.buf, r.len);
+    if (kind != CGO_SNIFF_MENU) {
+        /* hand the connection over instead of asking again */
+        view_stream(kind, &r, selector);
+        return;
+    }
+    /* a directory replaces what the tab was loading */
+    if (tabs[tab_current].loading) {
+        cgo_fetch_close(&tabs[tab_current].fetch);
+        tabs[tab_current].loading = 0;
     }
-    while (read_line(srvfd, line, sizeof(line))) {
+    /* only adapt current prompt when it is a directory */
+    if (make_current)
+        add_history();
+    /* don't overwrite the current_* things... */
+    if (host != current_host)
+        snprintf(current_host, sizeof(current_host), "%s", host);
+    if (port != current_port)
+        snprintf(current_port, sizeof(current_port), "%s", port);
+    if (selector != current_selector)
+        snprintf(current_selector, sizeof(current_selector),
+                "%s", selector);
+    clear_links();  /* clear links *AFTER* copying the current_* things!! */
+    while (cgo_reader_line(&r, line, sizeof(line))) {
+        page_add(&tabs[tab_current], line);
         handle_directory_line(line);
     }
-    close(srvfd);
+    if (r.failed)
+        puts("(reading the directory timed out, it may be incomplete)");
+    if (srvfd != -1)
+        close(srvfd);
 }
 
-void view_file(const char *cmd, const char *host,
-        const char *port, const char *selector)
+void run_viewer(const char *cmd, char **files, int num_files)
 {
     pid_t   pid;
     int     status, i, j;
-    char    buffer[1024], *argv[32], *p;
-
-    if (check_option_true(config.verbose))
-        printf("h(%s) p(%s) s(%s)\n", host, port, selector);
-
-    if (! download_temp(host, port, selector))
-        return;
+    char    buffer[1024], **argv, *p;
 
     /* parsed command line string */
+    argv = calloc(32 + num_files, sizeof(char*));
     argv[0] = &buffer[0];
     for (p = (char*) cmd, i = 0, j = 1; *p && i < sizeof(buffer) - 1 && j < 30; ) {
         if (*p == ' ' || *p == '\t') {
@@ -528,20 +903,38 @@ void view_file(const char *cmd, const char *host,
         } else buffer[i++] = *p++;
     }
     buffer[i] = 0;
-    argv[j++] = tmpfilename;
+    for (i = 0; i < num_files; i++)
+        argv[j++] = files[i];
     argv[j] = NULL;
 
     /* fork and execute */
     if (check_option_true(config.verbose))
-        printf("executing: %s %s\n", cmd, tmpfilename);
+        printf("executing: %s %s%s\n", cmd, files[0], num_files > 1 ? " ..." : "");
     pid = fork();
     if (pid == 0) {
         if (execvp(argv[0], argv) == -1)
             puts("error: execvp() failed!");
+        _exit(EXIT_FAILURE);
     } else if (pid == -1) puts("error: fork() failed");
     sleep(1); /* to wait for browsers etc. that return immediatly */
     waitpid(pid, &status, 0);
-    unlink(tmpfilename);
+    for (i = 0; i < num_files; i++)
+        unlink(files[i]);
+    free(argv);
+}
+
+void view_file(const char *cmd, const char *host,
+        const char *port, const char *selector)
+{
+    char    *files[1];
+
+    if (check_option_true(config.verbose))
+        printf("h(%s) p(%s) s(%s)\n", host, port, selector);
+
+    if (! download_temp(host, port, selector))
+        return;
+    files[0] = tmpfilename;
+    run_viewer(cmd, files, 1);
 }
 
 void view_telnet(const char *host, const char *port)
@@ -559,30 +952,36 @@ void view_telnet(const char *host, const char *port)
     puts("(done)");
 }
 
-void view_download(const char *host, const char *port, const char *selector)
+int ask_download(const char *selector, char *filename, size_t filename_len)
 {
     int     fd;
-    char    filename[1024], line[1024];
+    char    line[1024];
+    const char  *name = strrchr(selector, '/');
 
-    snprintf(filename, sizeof(filename), "%s", strrchr(selector, '/') + 1);
+    snprintf(filename, filename_len, "%s", name ? name + 1 : selector);
     printf("enter filename for download [%s]: ", filename);
     fflush(stdout);
     if (! read_line(0, line, sizeof(line))) {
         puts("download aborted");
-        return;
+        return -1;
     }
     if (strlen(line) > 0)
-#if defined(__OpenBSD__)
-        strlcpy(filename, line, sizeof(filename));
-#else
-        strcpy(filename, line);
-#endif
+        snprintf(filename, filename_len, "%s", line);
     fd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
-    if (fd == -1) {
+    if (fd == -1)
         printf("error: unable to create file [%s]: %s\n",
                 filename, strerror(errno));
+    return fd;
+}
+
+void view_download(const char *host, const char *port, const char *selector)
+{
+    int     fd;
+    char    filename[1024];
+
+    fd = ask_download(selector, filename, sizeof(filename));
+    if (fd == -1)
         return;
-    }
     if (! download_file(host, port, selector, fd)) {
         printf("error: unable to download [%s]\n", selector);
         unlink(filename);
@@ -590,6 +989,30 @@ void view_download(const char *host, const char *port, const char *selector)
     }
 }
 
+void view_stream(int kind, cgo_reader_t *r, const char *selector)
+{
+    const char  *kinds[] = { "directory", "text", "image", "sound", "binary" };
+    char        filename[1024], *files[1] = { tmpfilename };
+    int         fd;
+
+    printf("(not a directory, looks like %s)\n", kinds[kind]);
+    fd = kind == CGO_SNIFF_BINARY ?
+        ask_download(selector, filename, sizeof(filename)) : make_temp();
+    if (fd == -1) {
+        if (r->fd != -1)
+            close(r->fd);
+        return;
+    }
+    /* the bytes we already have go first */
+    copy_file(r->fd, r->buf + r->pos, r->len - r->pos, selector, fd);
+    if (kind == CGO_SNIFF_TEXT)
+        run_viewer(config.cmd_text, files, 1);
+    else if (kind == CGO_SNIFF_IMAGE)
+        run_viewer(config.cmd_image, files, 1);
+    else if (kind == CGO_SNIFF_SOUND)
+        run_viewer(config.cmd_player, files, 1);
+}
+
 void view_search(const char *host, const char *port, const char *selector)
 {
     char    search_selector[1024];
@@ -606,42 +1029,540 @@ void view_search(const char *host, const char *port, const char *selector)
     view_directory(host, port, search_selector, 1);
 }
 
-void view_history(int key)
+search_t *find_search(const char *query)
 {
-    int     history_key = 0;
-    char    a, b, c;
-    link_t  *link;
-
-    if (! history) {
-        puts("(empty history)");
-        return;
-    }
-    if ( key < 0 ) {
-        puts("(history)");
-        for ( link = history; link; link = link->next ) {
-            make_key_str(history_key++, &a, &b, &c);
-            printf("\033[%sm%c%c%c\033[0m \033[1m%s:%s/1%s\033[0m\n",
-                COLOR_SELECTOR, a, b, c, link->host, link->port, link->selector);
-        }
-    } else {
-        /* traverse history list */
-        for ( link = history; link; link = link->next, ++history_key ) {
-            if ( history_key == key ) {
-                view_directory(link->host, link->port, link->selector, 0);
-                return;
-            }
+    search_t    *s, **prev;
+    long        now = cgo_now_ms(), ttl = atol(config.search_ttl) * 1000L;
+
+    for (prev = &search_cache; (s = *prev); ) {
+        if (now - s->time > ttl) {
+            *prev = s->next;    /* drop expired results */
+            free(s->query);
+            free(s->data);
+            free(s);
+            continue;
         }
-        puts("history item not found");
+        if (! strcmp(s->query, query))
+            return s;
+        prev = &s->next;
     }
+    return NULL;
 }
 
-void view_bookmarks(int key)
+void cache_search(search_t *result, const char *query)
 {
-    int     i;
-    char    a, b, c;
+    search_t    *s, *next;
+    int         i;
 
-    if (key < 0) {
-        puts("(bookmarks)");
+    result->query = strdup(query);
+    result->time = cgo_now_ms();
+    result->next = search_cache;
+    search_cache = result;
+    /* forget the oldest results */
+    for (s = search_cache, i = 1; s && i < SEARCH_CACHE_LEN; s = s->next, i++) ;
+    if (! s)
+        return;
+    for (next = s->next, s->next = NULL; (s = next); ) {
+        next = s->next;
+        free(s->query);
+        free(s->data);
+        free(s);
+    }
+}
+
+int search_line(char *line, search_t *result, size_t *cap)
+{
+    char    copy[1024], *fields[4];
+    size_t  l;
+
+    if (! line[0] || ! strcmp(line, "."))
+        return 0;
+    if (line[0] != 'i' && line[0] != '3') {
+        snprintf(copy, sizeof(copy), "%s", line);
+        cgo_split_item(copy, fields);
+        if (fields[1] && fields[2] && fields[3] &&
+                find_link(fields[2], fields[3], fields[1]))
+            return 0;   /* already got this one from another server */
+    }
+    l = strlen(line);
+    if (*cap - result->len < l + 2) {
+        *cap = (*cap + l + 2) * 2;
+        result->data = realloc(result->data, *cap);
+    }
+    memcpy(result->data + result->len, line, l);
+    result->len += l;
+    result->data[result->len++] = '\n';
+    handle_directory_line(line);
+    return line[0] != 'i' && line[0] != '3';
+}
+
+void view_search_group(const char *query)
+{
+    cgo_fetch_t fetches[NUM_SEARCHES], *active[NUM_SEARCHES];
+    char        names[NUM_SEARCHES][600];
+    char        selector[1024], line[1024];
+    int         found[NUM_SEARCHES], reported[NUM_SEARCHES];
+    int         i, n, remaining, answered = 0, skipped = 0;
+    size_t      cap = 0, l;
+    long        elapsed, timeout = atol(config.search_timeout) * 1000L;
+    search_t    *result;
+
+    /* replay recent results */
+    if ((result = find_search(query))) {
+        clear_links();
+        for (i = 0; i < result->len; i += l + 1) {
+            l = (char*) memchr(result->data + i, '\n', result->len - i) - (result->data + i);
+            snprintf(line, sizeof(line), "%.*s", (int) l, result->data + i);
+            handle_directory_line(line);
+        }
+        printf("(cached results for [%s])\n", query);
+        return;
+    }
+    /* ask all servers at once */
+    for (i = 0, n = 0; i < NUM_SEARCHES; i++) {
+        if (! searches[i][0])
+            continue;
+        if (! parse_uri(&searches[i][0])) {
+            printf("invalid gopher URI: %s\n", &searches[i][0]);
+            continue;
+        }
+        if (snprintf(selector, sizeof(selector), "%s\t%s",
+                    parsed_selector, query) >= sizeof(selector)) {
+            printf("(%s:%s: search string too long)\n", parsed_host, parsed_port);
+            skipped++;
+            continue;
+        }
+        snprintf(names[n], sizeof(names[n]), "%s:%s", parsed_host, parsed_port);
+        cgo_fetch_start(&ctx, &fetches[n], parsed_host, parsed_port, selector, timeout);
+        active[n] = &fetches[n];
+        found[n] = reported[n] = 0;
+        n++;
+    }
+    if (! n) {
+        if (! skipped)
+            puts("(no search servers configured)");
+        return;
+    }
+    /* show results as they come in */
+    result = calloc(1, sizeof(search_t));
+    clear_links();
+    do {
+        remaining = cgo_fetch_wait(active, n, -1);
+        for (i = 0; i < n; i++) {
+            while (cgo_fetch_line(&fetches[i], line, sizeof(line)))
+                found[i] += search_line(line, result, &cap);
+            if (fetches[i].state < CGO_FETCH_DONE || reported[i])
+                continue;
+            reported[i] = 1;
+            elapsed = cgo_now_ms() - fetches[i].started;
+            if (fetches[i].state == CGO_FETCH_DONE) {
+                answered++;
+                printf("(%s: %d results in %ld ms)\n", names[i], found[i], elapsed);
+            } else if (timeout > 0 && elapsed >= timeout) {
+                printf("(%s: dropped after %ld ms)\n", names[i], elapsed);
+            } else {
+                printf("(%s: failed)\n", names[i]);
+            }
+        }
+    } while (remaining > 0);
+    for (i = 0; i < n; i++)
+        cgo_fetch_close(&fetches[i]);
+    /* partial results would hide the missing servers until search_ttl */
+    if (answered == n && ! skipped) {
+        cache_search(result, query);
+    } else {
+        free(result->data);
+        free(result);
+    }
+}
+
+unsigned long long hash_bytes(const char *data, size_t len)
+{
+    unsigned long long  h = 14695981039346656037ULL;    /* FNV-1a */
+
+    while (len--) {
+        h ^= (unsigned char) *data++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int compare_hash(const void *a, const void *b)
+{
+    unsigned long long  x = *(const unsigned long long*) a;
+    unsigned long long  y = *(const unsigned long long*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+int compare_watch(const void *a, const void *b)
+{
+    return strcmp(((const watch_t*) a)->uri, ((const watch_t*) b)->uri);
+}
+
+char uri_type(const char *uri)
+{
+    if (! strncmp(uri, "gopher://", 9))
+        uri += 9;
+    uri = strchr(uri, '/');
+    return uri && uri[1] ? uri[1] : '1';
+}
+
+void watch_filename(char *filename, size_t len, const char *suffix)
+{
+    const char  *home = getenv("HOME");
+
+    if (config.watchlist[0])
+        snprintf(filename, len, "%s%s", config.watchlist, suffix);
+    else
+        snprintf(filename, len, "%s%s%s", home ? home : ".", WATCHLIST_FILE, suffix);
+}
+
+void free_watch(watch_t *w)
+{
+    free(w->uri);
+    free(w->host);
+    free(w->port);
+    free(w->selector);
+    free(w->lines);
+}
+
+int load_watchlist(watch_t **list, watch_host_t **hosts, int *num_hosts)
+{
+    FILE        *fp;
+    char        filename[1024], line[1024], *p;
+    watch_t     *w;
+    int         n = 0, cap = 0, i, j;
+
+    *list = NULL;
+    *hosts = NULL;
+    *num_hosts = 0;
+    watch_filename(filename, sizeof(filename), "");
+    fp = fopen(filename, "r");
+    if (! fp) {
+        printf("error: cannot open watchlist [%s]: %s\n", filename, strerror(errno));
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        for (p = line; *p == ' ' || *p == '\t'; p++) ;
+        p[strcspn(p, "\r\n")] = 0;
+        if (! *p || *p == '#')
+            continue;
+        if (! parse_uri(p)) {
+            printf("invalid gopher URI: %s\n", p);
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            *list = realloc(*list, cap * sizeof(watch_t));
+        }
+        w = &(*list)[n++];
+        memset(w, 0, sizeof(watch_t));
+        w->uri = strdup(p);
+        w->type = uri_type(p);
+        w->host = strdup(parsed_host);
+        w->port = strdup(parsed_port);
+        w->selector = strdup(parsed_selector);
+        w->slot = -1;
+    }
+    fclose(fp);
+    /* sort by URI so the state file can be matched quickly */
+    qsort(*list, n, sizeof(watch_t), compare_watch);
+    for (i = 1, j = n ? 1 : 0; i < n; i++) {
+        if (strcmp((*list)[i].uri, (*list)[j - 1].uri))
+            (*list)[j++] = (*list)[i];
+        else
+            free_watch(&(*list)[i]);
+    }
+    n = j;
+    /* one rate limit per host */
+    *hosts = calloc(n ? n : 1, sizeof(watch_host_t));
+    *num_hosts = 0;
+    for (i = 0; i < n; i++) {
+        for (j = *num_hosts - 1; j >= 0; j--)
+            if (! strcmp((*hosts)[j].name, (*list)[i].host))
+                break;
+        if (j < 0) {
+            j = (*num_hosts)++;
+            (*hosts)[j].name = (*list)[i].host;
+        }
+        (*list)[i].host_index = j;
+    }
+    return n;
+}
+
+void load_watch_state(watch_t *list, int n)
+{
+    FILE                *fp;
+    char                filename[1024], *line = NULL, *p, *tab;
+    size_t              len = 0, i;
+    watch_t             key, *w;
+    long                last, now = time(NULL);
+    long                interval = atol(config.watch_interval);
+
+    watch_filename(filename, sizeof(filename), WATCH_STATE_SUFFIX);
+    fp = fopen(filename, "r");
+    if (! fp)
+        return;
+    while (getline(&line, &len, fp) != -1) {
+        if (! (tab = strchr(line, '\t')))
+            continue;
+        *tab = 0;
+        key.uri = line;
+        w = bsearch(&key, list, n, sizeof(watch_t), compare_watch);
+        if (! w)
+            continue;   /* no longer watched */
+        last = strtol(tab + 1, &p, 10);
+        w->hash = strtoull(p, &p, 16);
+        w->num_lines = strtoul(p, &p, 10);
+        w->lines = calloc(w->num_lines ? w->num_lines : 1, sizeof(unsigned long long));
+        for (i = 0; i < w->num_lines && *p && *p != '\n'; i++)
+            w->lines[i] = strtoull(p, &p, 16);
+        w->num_lines = i;
+        w->last = last;
+        w->known = 1;
+        /* don't poll before the interval is over */
+        if (last + interval > now)
+            w->next = cgo_now_ms() + (last + interval - now) * 1000L;
+    }
+    free(line);
+    fclose(fp);
+}
+
+void save_watch_state(watch_t *list, int n)
+{
+    FILE    *fp;
+    char    filename[1024], tmpname[1100];
+    int     i;
+    size_t  j;
+
+    watch_filename(filename, sizeof(filename), WATCH_STATE_SUFFIX);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    fp = fopen(tmpname, "w");
+    if (! fp) {
+        printf("error: cannot write watch state [%s]: %s\n", tmpname, strerror(errno));
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (! list[i].known)
+            continue;
+        fprintf(fp, "%s\t%ld %016llx %lu", list[i].uri, list[i].last,
+                list[i].hash, (unsigned long) list[i].num_lines);
+        for (j = 0; j < list[i].num_lines; j++)
+            fprintf(fp, " %016llx", list[i].lines[j]);
+        fputc('\n', fp);
+    }
+    if (fclose(fp) == 0)
+        rename(tmpname, filename);
+}
+
+int watch_update(watch_t *w, cgo_fetch_t *f, int clear)
+{
+    unsigned long long  hash, *lines = NULL;
+    size_t              num_lines = 0, cap = 0;
+    char                line[1024];
+    int                 changes = 0;
+
+    w->last = time(NULL);
+    hash = hash_bytes(f->data ? f->data : "", f->len);
+    if (w->known && hash == w->hash)
+        return 0;
+    if (w->type != '1') {
+        /* no menu - announce the selector itself */
+        if (w->known) {
+            if (clear)
+                clear_links();
+            printf("(%s changed)\n", w->uri);
+            add_link(w->type, w->uri, w->host, w->port, w->selector);
+            changes = 1;
+        }
+        w->hash = hash;
+        w->known = 1;
+        return changes;
+    }
+    while (cgo_fetch_line(f, line, sizeof(line))) {
+        if (! line[0] || ! strcmp(line, "."))
+            continue;
+        if (num_lines == cap) {
+            cap = cap ? cap * 2 : 64;
+            lines = realloc(lines, cap * sizeof(unsigned long long));
+        }
+        lines[num_lines] = hash_bytes(line, strlen(line));
+        if (w->known && line[0] != 'i' && line[0] != '3' &&
+                ! bsearch(&lines[num_lines], w->lines, w->num_lines,
+                    sizeof(unsigned long long), compare_hash)) {
+            if (! changes++) {
+                if (clear)
+                    clear_links();  /* keep the page until there is news */
+                printf("(%s)\n", w->uri);
+            }
+            handle_directory_line(line);
+        }
+        num_lines++;
+    }
+    qsort(lines, num_lines, sizeof(unsigned long long), compare_hash);
+    free(w->lines);
+    w->lines = lines;
+    w->num_lines = num_lines;
+    w->hash = hash;
+    w->known = 1;
+    return changes;
+}
+
+void watch(int forever)
+{
+    watch_t         *list, *w;
+    watch_host_t    *hosts, *h;
+    cgo_fetch_t     slots[WATCH_MAX_ACTIVE];
+    struct pollfd   pfds[WATCH_MAX_ACTIVE + 1];
+    int             n, num_hosts, i, active = 0, pending, changes = 0;
+    char            line[1024];
+    long            now, wake, next, saved;
+    long            interval = atol(config.watch_interval) * 1000L;
+    long            delay = atol(config.watch_delay) * 1000L;
+
+    n = load_watchlist(&list, &hosts, &num_hosts);
+    if (! n) {
+        puts("(empty watchlist)");
+        free(hosts);
+        return;
+    }
+    load_watch_state(list, n);
+    if (interval < 1000)
+        interval = 1000;
+    srand(time(NULL) ^ getpid());
+    for (i = 0; i < WATCH_MAX_ACTIVE; i++)
+        slots[i].fd = -1;
+    /* a single round polls everything right now */
+    if (! forever)
+        for (i = 0; i < n; i++)
+            list[i].next = 0;
+    printf("(watching %d selectors on %d hosts)\n", n, num_hosts);
+    pending = n;
+    saved = cgo_now_ms();
+    while (forever || pending > 0 || active > 0) {
+        /* start whatever is due and allowed */
+        now = cgo_now_ms();
+        wake = now + interval;
+        for (i = 0; i < n && (forever || pending > 0); i++) {
+            w = &list[i];
+            h = &hosts[w->host_index];
+            if (w->slot != -1 || (! forever && w->polled))
+                continue;
+            next = w->next > h->next ? w->next : h->next;
+            if (next > now || h->busy || active == WATCH_MAX_ACTIVE) {
+                if (! h->busy && active < WATCH_MAX_ACTIVE && next < wake)
+                    wake = next;
+                continue;
+            }
+            for (w->slot = 0; slots[w->slot].fd != -1; w->slot++) ;
+            cgo_fetch_start(&ctx, &slots[w->slot], w->host, w->port, w->selector, WATCH_TIMEOUT);
+            if (slots[w->slot].state == CGO_FETCH_FAILED) {
+                slots[w->slot].fd = -1;
+                w->slot = -1;
+                w->polled = 1;
+                w->next = now + interval;
+                pending--;
+                continue;
+            }
+            h->busy = 1;
+            active++;
+        }
+        if (! forever && pending <= 0 && active == 0)
+            break;
+        /* wait for sockets, the next due selector or the user */
+        for (i = 0; i < WATCH_MAX_ACTIVE; i++)
+            cgo_fetch_pollfd(&slots[i], &pfds[i]);
+        pfds[i].fd = forever ? 0 : -1;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+        next = wake - now;
+        if (active && next > 1000) next = 1000;     /* check deadlines */
+        if (next < 0) next = 0;
+        if (poll(pfds, WATCH_MAX_ACTIVE + 1, next) == -1 && errno != EINTR)
+            break;
+        if (pfds[WATCH_MAX_ACTIVE].revents) {
+            if (! read_line(0, line, sizeof(line)))
+                break;
+            follow_link(make_key(line[0], line[1], line[2]));
+        }
+        for (i = 0; i < n; i++) {
+            w = &list[i];
+            if (w->slot == -1)
+                continue;
+            cgo_fetch_handle(&slots[w->slot], pfds[w->slot].revents);
+            if (slots[w->slot].state < CGO_FETCH_DONE)
+                continue;
+            /* one round keeps all its news, -w only the last few screens */
+            if (slots[w->slot].state == CGO_FETCH_DONE)
+                changes += watch_update(w, &slots[w->slot],
+                        forever ? link_key >= WATCH_MAX_LINKS : ! changes);
+            else if (check_option_true(config.verbose))
+                printf("(%s failed)\n", w->uri);
+            cgo_fetch_close(&slots[w->slot]);
+            w->slot = -1;
+            w->polled = 1;
+            /* jitter by +/- 10% so selectors don't bunch up */
+            w->next = cgo_now_ms() + interval - interval / 10 +
+                (long) (rand() / (RAND_MAX + 1.0) * (interval / 5));
+            h = &hosts[w->host_index];
+            h->busy = 0;
+            h->next = cgo_now_ms() + delay;
+            active--;
+            pending--;
+        }
+        if (forever && cgo_now_ms() - saved > WATCH_SAVE_INTERVAL) {
+            save_watch_state(list, n);
+            saved = cgo_now_ms();
+        }
+    }
+    for (i = 0; i < WATCH_MAX_ACTIVE; i++)
+        if (slots[i].fd != -1) cgo_fetch_close(&slots[i]);
+    save_watch_state(list, n);
+    if (! forever && ! changes)
+        puts("(no changes)");
+    for (i = 0; i < n; i++)
+        free_watch(&list[i]);
+    free(list);
+    free(hosts);
+}
+
+void view_history(int key)
+{
+    int     history_key = 0;
+    char    a, b, c;
+    link_t  *link;
+
+    if (! history) {
+        puts("(empty history)");
+        return;
+    }
+    if ( key < 0 ) {
+        puts("(history)");
+        for ( link = history; link; link = link->next ) {
+            make_key_str(history_key++, &a, &b, &c);
+            printf("\033[%sm%c%c%c\033[0m \033[1m%s:%s/1%s\033[0m\n",
+                COLOR_SELECTOR, a, b, c, link->host, link->port, link->selector);
+        }
+    } else {
+        /* traverse history list */
+        for ( link = history; link; link = link->next, ++history_key ) {
+            if ( history_key == key ) {
+                view_directory(link->host, link->port, link->selector, 0);
+                return;
+            }
+        }
+        puts("history item not found");
+    }
+}
+
+void view_bookmarks(int key)
+{
+    int     i;
+    char    a, b, c;
+
+    if (key < 0) {
+        puts("(bookmarks)");
         for (i = 0; i < NUM_BOOKMARKS; i++) {
             if (bookmarks[i][0]) {
                 make_key_str(i, &a, &b, &c);
@@ -679,6 +1600,618 @@ void pop_history()
     history = next;
 }
 
+const char *type_command(char which)
+{
+    switch (which) {
+        case '0':
+            return config.cmd_text;
+        case 'g':
+        case 'I':
+        case 'p':
+            return config.cmd_image;
+        case 'h':
+            return config.cmd_browser;
+        case 's':
+            return config.cmd_player;
+        default:
+            return NULL;
+    }
+}
+
+int compare_link_key(const void *a, const void *b)
+{
+    return (*(link_t* const*) a)->key - (*(link_t* const*) b)->key;
+}
+
+void archive_fetch(cgo_fetch_t *f, const char *host, const char *port,
+        const char *selector)
+{
+    const char  *data;
+    size_t      len;
+
+    memset(f, 0, sizeof(cgo_fetch_t));
+    f->fd = -1;
+    f->started = cgo_now_ms();
+    f->state = CGO_FETCH_FAILED;
+    if (! cgo_archive_lookup(&archive, host, port, selector, NULL, &data, &len))
+        return;
+    f->data = malloc(len ? len : 1);
+    memcpy(f->data, data, len);
+    f->len = f->cap = len;
+    f->state = CGO_FETCH_DONE;
+}
+
+void view_bulk(const char *types)
+{
+    link_t          *link, **items;
+    cgo_fetch_t     *fetches, **active;
+    char            **files, **group, *handled;
+    const char      *commands[] = { config.cmd_image, config.cmd_player,
+                        config.cmd_text, config.cmd_browser };
+    int             i, j, n, num_active, next = 0, done = 0, ok = 0, fd;
+    int             max = atoi(config.bulk_max);
+    long            started, elapsed, wait, latency = 0, longest = 0;
+    unsigned long   total = 0;
+
+    if (! *types)
+        types = BULK_TYPES;
+    for (link = links, n = 0; link; link = link->next)
+        if (strchr(types, link->which) && type_command(link->which))
+            n++;
+    if (! n) {
+        puts("(nothing to fetch)");
+        return;
+    }
+    if (max < 1)
+        max = 1;
+    /* in menu order */
+    items = calloc(n, sizeof(link_t*));
+    for (link = links, i = 0; link; link = link->next)
+        if (strchr(types, link->which) && type_command(link->which))
+            items[i++] = link;
+    qsort(items, n, sizeof(link_t*), compare_link_key);
+    fetches = calloc(n, sizeof(cgo_fetch_t));
+    active = calloc(max, sizeof(cgo_fetch_t*));
+    files = calloc(n, sizeof(char*));
+    handled = calloc(n, 1);
+
+    /* at most bulk_max fetches at once */
+    started = cgo_now_ms();
+    while (done < n) {
+        for (i = 0, num_active = 0; i < next; i++)
+            if (fetches[i].state < CGO_FETCH_DONE)
+                num_active++;
+        for (; next < n && num_active < max; next++, num_active++)
+            if (archive.map)
+                archive_fetch(&fetches[next], items[next]->host,
+                        items[next]->port, items[next]->selector);
+            else {
+                /* give up on servers that stop sending */
+                cgo_fetch_start(&ctx, &fetches[next], items[next]->host,
+                        items[next]->port, items[next]->selector, BULK_TIMEOUT);
+                fetches[next].idle = BULK_TIMEOUT;
+            }
+        for (i = 0, j = 0; i < next; i++)
+            if (fetches[i].state < CGO_FETCH_DONE)
+                active[j++] = &fetches[i];
+        if (j > 0)
+            cgo_fetch_wait(active, j, -1);
+        for (i = 0; i < next; i++) {
+            if (fetches[i].state < CGO_FETCH_DONE || handled[i])
+                continue;
+            /* store finished ones right away */
+            if (fetches[i].first_byte) {
+                wait = fetches[i].first_byte - fetches[i].started;
+                latency += wait;
+                if (wait > longest)
+                    longest = wait;
+            }
+            handled[i] = 1;
+            done++;
+            if (fetches[i].state == CGO_FETCH_FAILED || (fd = make_temp()) == -1) {
+                printf("\033[2Kerror: downloading [%s] failed\n", items[i]->selector);
+                cgo_fetch_close(&fetches[i]);
+                continue;
+            }
+            write(fd, fetches[i].data, fetches[i].len);
+            close(fd);
+            files[i] = strdup(tmpfilename);
+            total += fetches[i].len;
+            ok++;
+            cgo_fetch_close(&fetches[i]);
+            if (check_option_true(config.verbose))
+                printf("\033[2Kdownloading [%d/%d] (%ld kb)...\r", done, n, total / 1024);
+        }
+    }
+    /*
+     * waiting for servers is what fetching at once saves, not bandwidth:
+     * one at a time would have waited for each of them, not just the longest
+     */
+    elapsed = cgo_now_ms() - started;
+    printf("\033[2K(%d of %d files, %ld kb in %ld ms, one at a time estimated %ld ms)\n",
+            ok, n, total / 1024, elapsed, elapsed + latency - longest);
+
+    /* one viewer per kind of file */
+    group = calloc(n, sizeof(char*));
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        for (j = 0, n = 0; j < next; j++)
+            if (files[j] && type_command(items[j]->which) == commands[i])
+                group[n++] = files[j];
+        if (n > 0)
+            run_viewer(commands[i], group, n);
+    }
+    for (i = 0; i < next; i++)
+        free(files[i]);
+    free(group);
+    free(files);
+    free(handled);
+    free(active);
+    free(fetches);
+    free(items);
+}
+
+void page_add(tab_t *t, const char *line)
+{
+    size_t  len = strlen(line);
+
+    if (t->page_len + len + 1 > t->page_cap) {
+        t->page_cap = (t->page_cap ? t->page_cap * 2 : 4096) + len;
+        t->page = realloc(t->page, t->page_cap);
+    }
+    memcpy(t->page + t->page_len, line, len);
+    t->page_len += len;
+    t->page[t->page_len++] = '\n';
+}
+
+size_t links_memory(link_t *link)
+{
+    size_t  size = 0;
+
+    for (; link; link = link->next)
+        size += sizeof(link_t) + strlen(link->host) + strlen(link->port) +
+            strlen(link->selector) + 3;
+    return size;
+}
+
+size_t tab_memory(tab_t *t)
+{
+    if (t == &tabs[tab_current])
+        return t->page_cap + links_memory(links) + links_memory(history);
+    return t->page_cap + t->fetch.cap + links_memory(t->links) + links_memory(t->history);
+}
+
+int tab_find(const char *name)
+{
+    int     i;
+
+    for (i = 0; i < NUM_TABS; i++)
+        if (tabs[i].name[0] && ! strcmp(tabs[i].name, name))
+            return i;
+    /* or by number */
+    i = atoi(name) - 1;
+    if (name[0] >= '1' && name[0] <= '9' && ! name[1] && tabs[i].name[0])
+        return i;
+    return -1;
+}
+
+void tab_trim(tab_t *t)
+{
+    size_t  limit = atol(config.tab_memory) * 1024;
+    link_t  **link;
+
+    /* the page rebuilds the links when switching back */
+    if (t->page) {
+        free_links(t->links);
+        t->links = NULL;
+        t->link_key = 0;
+    }
+    if (t->page && t->page_len > 0 && t->page_cap > t->page_len) {
+        t->page = realloc(t->page, t->page_len);
+        t->page_cap = t->page_len;
+    }
+    /* then drop the oldest history, then the page itself */
+    while (t->history && tab_memory(t) > limit) {
+        for (link = &t->history; (*link)->next; link = &(*link)->next) ;
+        free_links(*link);
+        *link = NULL;
+    }
+    if (tab_memory(t) > limit) {
+        /* the page, or links without one (search, watch) */
+        free(t->page);
+        t->page = NULL;
+        t->page_len = t->page_cap = 0;
+        free_links(t->links);
+        t->links = NULL;
+        t->link_key = 0;
+    }
+}
+
+void tab_save()
+{
+    tab_t   *t = &tabs[tab_current];
+
+    t->links = links;
+    t->history = history;
+    t->link_key = link_key;
+    snprintf(t->host, sizeof(t->host), "%s", current_host);
+    snprintf(t->port, sizeof(t->port), "%s", current_port);
+    snprintf(t->selector, sizeof(t->selector), "%s", current_selector);
+    links = history = NULL;
+    link_key = 0;
+}
+
+void tab_restore()
+{
+    tab_t   *t = &tabs[tab_current];
+
+    links = t->links;
+    history = t->history;
+    link_key = t->link_key;
+    snprintf(current_host, sizeof(current_host), "%s", t->host);
+    snprintf(current_port, sizeof(current_port), "%s", t->port);
+    snprintf(current_selector, sizeof(current_selector), "%s", t->selector);
+    t->links = t->history = NULL;
+}
+
+void tab_draw()
+{
+    tab_t   *t = &tabs[tab_current];
+    char    *page = t->page, *line, *nl;
+    size_t  len = t->page_len;
+
+    /* replay the page, which rebuilds the same links */
+    t->page = NULL;
+    t->page_len = t->page_cap = 0;
+    clear_links();
+    for (line = page; line < page + len; line = nl + 1) {
+        nl = memchr(line, '\n', page + len - line);
+        *nl = 0;
+        page_add(t, line);
+        handle_directory_line(line);
+    }
+    free(page);
+}
+
+void tab_switch(int i)
+{
+    tab_t   *t = &tabs[i];
+    int     old = tab_current;
+
+    if (i != tab_current) {
+        tab_save();
+        tab_current = i;
+        tab_trim(&tabs[old]);
+        tab_restore();
+    }
+    if (t->loading)
+        printf("(tab [%s] is still loading %s:%s%s)\n",
+                t->name, t->load_host, t->load_port, t->load_selector);
+    else if (t->page)
+        tab_draw();
+    else if (current_host[0] && ! links) {
+        puts("(page was dropped to save memory, reloading)");
+        view_directory(current_host, current_port, current_selector, 0);
+    } else if (links)
+        puts("(links of the last search or watch are kept, * reloads the directory)");
+}
+
+void tab_open(const char *name, const char *target)
+{
+    tab_t   *t;
+    link_t  *link = NULL;
+    int     i = tab_find(name);
+
+    if (! name[0]) {
+        puts("tab name missing");
+        return;
+    }
+    if (strspn(target, "abcdefghijklmnopqrstuvwxyz") == strlen(target) &&
+            strlen(target) >= 2 && strlen(target) <= 3) {
+        for (link = links; link; link = link->next)
+            if (link->key == make_key(target[0], target[1], target[2]))
+                break;
+        if (! link) {
+            puts("link not found");
+            return;
+        }
+        if (link->which != '1') {
+            printf("(link %s is not a directory)\n", target);
+            return;
+        }
+    } else if (! parse_uri(target)) {
+        puts("invalid gopher URI");
+        return;
+    }
+    if (i == -1)
+        for (i = 0; i < NUM_TABS && tabs[i].name[0]; i++) ;
+    if (i == NUM_TABS) {
+        printf("(no more than %d tabs)\n", NUM_TABS);
+        return;
+    }
+    t = &tabs[i];
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    snprintf(t->load_host, sizeof(t->load_host), "%s", link ? link->host : parsed_host);
+    snprintf(t->load_port, sizeof(t->load_port), "%s", link ? link->port : parsed_port);
+    snprintf(t->load_selector, sizeof(t->load_selector), "%s",
+            link ? link->selector : parsed_selector);
+    if (i == tab_current) {
+        view_directory(t->load_host, t->load_port, t->load_selector, 1);
+        return;
+    }
+    /* load in the background, read_prompt() keeps it going */
+    if (t->loading)
+        cgo_fetch_close(&t->fetch);
+    if (archive.map)
+        archive_fetch(&t->fetch, t->load_host, t->load_port, t->load_selector);
+    else {
+        cgo_fetch_start(&ctx, &t->fetch, t->load_host, t->load_port,
+                t->load_selector, TAB_TIMEOUT);
+        /* only silence counts, not time spent in a viewer */
+        t->fetch.idle = TAB_TIMEOUT;
+    }
+    t->loading = 1;
+    tab_check();
+}
+
+int tab_check()
+{
+    tab_t   *t;
+    char    line[1024];
+    size_t  limit = atol(config.tab_memory) * 1024;
+    int     i, finished = 0;
+
+    for (i = 0; i < NUM_TABS; i++) {
+        t = &tabs[i];
+        if (! t->loading)
+            continue;
+        if (t->fetch.state < CGO_FETCH_DONE && t->fetch.len <= limit)
+            continue;
+        t->loading = 0;
+        finished++;
+        if (t->fetch.state != CGO_FETCH_DONE) {
+            printf("\r\033[2K(tab [%s] %s %s:%s%s)\n", t->name,
+                    t->fetch.state == CGO_FETCH_FAILED ? "failed to load" :
+                    "is over tab_memory with",
+                    t->load_host, t->load_port, t->load_selector);
+        } else if (cgo_sniff(t->fetch.data, t->fetch.len) != CGO_SNIFF_MENU) {
+            printf("\r\033[2K(tab [%s]: %s:%s%s is not a directory)\n", t->name,
+                    t->load_host, t->load_port, t->load_selector);
+        } else if (i == tab_current) {
+            /* switched to it meanwhile */
+            if (current_host[0])
+                add_history();
+            snprintf(current_host, sizeof(current_host), "%s", t->load_host);
+            snprintf(current_port, sizeof(current_port), "%s", t->load_port);
+            snprintf(current_selector, sizeof(current_selector), "%s", t->load_selector);
+            clear_links();
+            while (cgo_fetch_line(&t->fetch, line, sizeof(line)))
+                page_add(t, line);
+            puts("\r\033[2K");
+            tab_draw();
+        } else {
+            if (t->host[0])
+                push_history(&t->history, t->host, t->port, t->selector);
+            snprintf(t->host, sizeof(t->host), "%s", t->load_host);
+            snprintf(t->port, sizeof(t->port), "%s", t->load_port);
+            snprintf(t->selector, sizeof(t->selector), "%s", t->load_selector);
+            free_links(t->links);
+            t->links = NULL;
+            t->link_key = 0;
+            t->page_len = 0;
+            while (cgo_fetch_line(&t->fetch, line, sizeof(line)))
+                page_add(t, line);
+            printf("\r\033[2K(tab [%s] loaded, %ld kb)\n", t->name,
+                    (long) (t->fetch.len + 1023) / 1024);
+        }
+        cgo_fetch_close(&t->fetch);
+        if (i != tab_current)
+            tab_trim(t);
+    }
+    return finished;
+}
+
+void tab_close(const char *name)
+{
+    int     i = tab_find(name);
+    tab_t   *t;
+
+    if (i == -1) {
+        puts("tab not found");
+        return;
+    }
+    t = &tabs[i];
+    if (i == tab_current) {
+        puts("(cannot close the current tab)");
+        return;
+    }
+    if (t->loading)
+        cgo_fetch_close(&t->fetch);
+    free_links(t->links);
+    free_links(t->history);
+    free(t->page);
+    memset(t, 0, sizeof(tab_t));
+}
+
+void view_tabs()
+{
+    tab_t   *t;
+    int     i;
+    size_t  size, total = 0;
+
+    for (i = 0; i < NUM_TABS; i++) {
+        t = &tabs[i];
+        if (! t->name[0])
+            continue;
+        size = tab_memory(t);
+        total += size;
+        printf("\033[%sm%d\033[0m%c\033[1m%-12s\033[0m ", config.color_selector,
+                i + 1, i == tab_current ? '*' : ' ', t->name);
+        if (t->loading)
+            printf("loading %s:%s%s (%ld kb so far)\n", t->load_host, t->load_port,
+                    t->load_selector, (long) (t->fetch.len + 1023) / 1024);
+        else if (! (i == tab_current ? current_host : t->host)[0])
+            puts("(empty)");
+        else if (i == tab_current)
+            printf("%s:%s%s (%ld kb)\n", current_host, current_port,
+                    current_selector, (long) (size + 1023) / 1024);
+        else
+            printf("%s:%s%s (%ld kb%s)\n", t->host, t->port, t->selector,
+                    (long) (size + 1023) / 1024, t->page ? "" : ", not kept");
+    }
+    printf("(%ld kb in all, at most %s kb per idle tab)\n",
+            (long) (total + 1023) / 1024, config.tab_memory);
+}
+
+void print_prompt()
+{
+    int     i, shown = 0;
+
+    printf("\033[%sm%s:%s%s\033[0m ", config.color_prompt,
+            current_host, current_port, current_selector);
+    /* the other tabs, '+' while loading */
+    for (i = 0; i < NUM_TABS; i++) {
+        if (i == tab_current || ! tabs[i].name[0])
+            continue;
+        printf("%s%s%s", shown++ ? " " : "[", tabs[i].name, tabs[i].loading ? "+" : "");
+    }
+    if (shown)
+        printf("] ");
+    if (tabs[tab_current].loading)
+        printf("(loading) ");
+    fflush(stdout); /* to display the prompt */
+}
+
+int export_add(export_t **queue, int *n, int *cap, int *buckets,
+        const cgo_item_t *item)
+{
+    unsigned int    b;
+    int             i;
+    size_t          l = strlen(current_selector);
+
+    if (! item->host || ! item->port || ! item->selector)
+        return 0;
+    /* stay below the menu the export started from */
+    if (! strchr("0159gIps", item->type) && (item->type != 'h' ||
+                ! strncmp(item->selector, "URL:", 4)))
+        return 0;
+    if (strcmp(item->host, current_host) || strcmp(item->port, current_port) ||
+            strncmp(item->selector, current_selector, l))
+        return 0;
+    /* /sub/x is below /sub, /subway is not */
+    if (l > 0 && current_selector[l - 1] != '/' && item->selector[l] &&
+            item->selector[l] != '/')
+        return 0;
+    b = hash_bytes(item->selector, strlen(item->selector)) % EXPORT_BUCKETS;
+    for (i = buckets[b]; i != -1; i = (*queue)[i].next)
+        if (! strcmp((*queue)[i].selector, item->selector))
+            return 0;
+    if (*n >= EXPORT_MAX)
+        return 0;
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *queue = realloc(*queue, *cap * sizeof(export_t));
+    }
+    (*queue)[*n].type = item->type;
+    (*queue)[*n].selector = strdup(item->selector);
+    (*queue)[*n].next = buckets[b];
+    buckets[b] = (*n)++;
+    return 1;
+}
+
+void export_archive(const char *filename)
+{
+    cgo_archive_writer_t    w;
+    cgo_fetch_t             *fetches, **active;
+    cgo_item_t              item;
+    export_t                *queue = NULL;
+    int                     *slots, buckets[EXPORT_BUCKETS];
+    int                     i, j, n = 0, cap = 0, next = 0, busy = 0, ok = 0;
+    int                     max = atoi(config.bulk_max);
+    char                    line[1024];
+    unsigned long           total = 0;
+    long                    started = cgo_now_ms();
+
+    if (archive.map) {
+        puts("(not available offline)");
+        return;
+    }
+    if (! cgo_archive_begin(&ctx, &w, filename)) {
+        printf("error: %s\n", ctx.error);
+        return;
+    }
+    if (max < 1)
+        max = 1;
+    for (i = 0; i < EXPORT_BUCKETS; i++)
+        buckets[i] = -1;
+    item.type = '1';
+    item.host = current_host;
+    item.port = current_port;
+    item.selector = current_selector;
+    export_add(&queue, &n, &cap, buckets, &item);
+    fetches = calloc(max, sizeof(cgo_fetch_t));
+    active = calloc(max, sizeof(cgo_fetch_t*));
+    slots = calloc(max, sizeof(int));
+    for (i = 0; i < max; i++)
+        slots[i] = -1;
+
+    /* breadth first, with at most bulk_max fetches at once */
+    while (next < n || busy > 0) {
+        for (i = 0; i < max && next < n; i++) {
+            if (slots[i] != -1)
+                continue;
+            cgo_fetch_start(&ctx, &fetches[i], current_host, current_port,
+                    queue[next].selector, EXPORT_TIMEOUT);
+            fetches[i].idle = EXPORT_TIMEOUT;  /* large files are fine while they flow */
+            slots[i] = next++;
+            busy++;
+        }
+        for (i = 0, j = 0; i < max; i++)
+            if (slots[i] != -1 && fetches[i].state < CGO_FETCH_DONE)
+                active[j++] = &fetches[i];
+        if (j > 0)
+            cgo_fetch_wait(active, j, -1);
+        for (i = 0; i < max; i++) {
+            if (slots[i] == -1 || fetches[i].state < CGO_FETCH_DONE)
+                continue;
+            j = slots[i];
+            slots[i] = -1;
+            busy--;
+            if (fetches[i].state == CGO_FETCH_FAILED) {
+                printf("\033[2Kerror: exporting [%s] failed\n", queue[j].selector);
+                cgo_fetch_close(&fetches[i]);
+                continue;
+            }
+            if (! cgo_archive_add(&ctx, &w, current_host, current_port,
+                        queue[j].selector, queue[j].type, fetches[i].data, fetches[i].len)) {
+                printf("\033[2Kerror: %s\n", ctx.error);
+                cgo_fetch_close(&fetches[i]);
+                continue;
+            }
+            ok++;
+            total += fetches[i].len;
+            if (queue[j].type == '1')
+                while (cgo_fetch_line(&fetches[i], line, sizeof(line)))
+                    if (cgo_parse_item(line, &item))
+                        export_add(&queue, &n, &cap, buckets, &item);
+            cgo_fetch_close(&fetches[i]);
+            if (check_option_true(config.verbose))
+                printf("\033[2Kexporting [%d/%d] (%ld kb)...\r", ok, n, total / 1024);
+        }
+    }
+    if (! cgo_archive_commit(&ctx, &w, current_host, current_port, current_selector))
+        printf("\033[2Kerror: %s\n", ctx.error);
+    else
+        printf("\033[2K(%d of %d items, %ld kb in %ld ms, saved to [%s]%s)\n",
+                ok, n, total / 1024, cgo_now_ms() - started, filename,
+                n >= EXPORT_MAX ? ", limit reached" : "");
+    for (i = 0; i < n; i++)
+        free(queue[i].selector);
+    free(queue);
+    free(slots);
+    free(active);
+    free(fetches);
+}
+
 int follow_link(int key)
 {
     link_t  *link;
@@ -738,40 +2271,510 @@ void download_link(int key)
 
 int parse_uri(const char *uri)
 {
-    int     i;
+    cgo_uri_t   parsed;
 
-    /* strip gopher:// */
-    if (! strncmp(uri, "gopher://", 9))
-        uri += 9;
-    /* parse host */
-    for (i = 0; *uri && *uri != ':' && *uri != '/'; uri++) {
-        if (*uri != ' ' && i < sizeof(parsed_host) - 1)
-            parsed_host[i++] = *uri;
-    }
-    if (i > 0) parsed_host[i] = 0;
-    else return 0;
-    /* parse port */
-    if (*uri == ':') {
-        uri++;
-        for (i = 0; *uri && *uri != '/'; uri++)
-            if (*uri != ' ' && i < sizeof(parsed_port) - 1)
-                parsed_port[i++] = *uri;
-        parsed_port[i] = 0;
-    } else snprintf(parsed_port, sizeof(parsed_port), "%d", 70);
-    /* parse selector (ignore slash and selector type) */
-    if (*uri) ++uri;
-    if (*uri) ++uri;
-    for (i = 0; *uri && i < sizeof(parsed_selector) - 1; ++uri, ++i)
-        parsed_selector[i] = *uri;
-    parsed_selector[i] = '\0';
+    if (! cgo_parse_uri(uri, &parsed))
+        return 0;
+    snprintf(parsed_host, sizeof(parsed_host), "%s", parsed.host);
+    snprintf(parsed_port, sizeof(parsed_port), "%s", parsed.port);
+    snprintf(parsed_selector, sizeof(parsed_selector), "%s", parsed.selector);
+    return 1;
+}
+
+int proxy_listen(const char *addr)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *r;
+    char            host[512];
+    const char      *port;
+    int             fd = -1, on = 1;
 
+    port = strrchr(addr, ':');
+    if (! port) {
+        fprintf(stderr, "error: invalid listen address '%s'\n", addr);
+        return -1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int) (port - addr), addr);
+    port++;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0) {
+        fprintf(stderr, "error: cannot resolve listen address '%s'\n", addr);
+        return -1;
+    }
+    for (r = res; r; r = r->ai_next) {
+        fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+        if (fd == -1)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, r->ai_addr, r->ai_addrlen) == 0 && listen(fd, 64) == 0)
+            break;
+        close(fd);
+    }
+    freeaddrinfo(res);
+    if (! r) {
+        fprintf(stderr, "error: cannot listen on '%s': %s\n", addr, strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int proxy_port_allowed(const char *host, const char *port)
+{
+    const char  *p = config.proxy_ports;
+    size_t      len;
+
+    if (! strcmp(host, proxy_upstream_host) && ! strcmp(port, proxy_upstream_port))
+        return 1;
+    /* space or comma separated, "*" allows every port */
+    for (;;) {
+        p += strspn(p, " \t,");
+        if (! *p)
+            return 0;
+        len = strcspn(p, " \t,");
+        if ((len == 1 && *p == '*') || (len == strlen(port) && ! strncmp(p, port, len)))
+            return 1;
+        p += len;
+    }
+}
+
+int proxy_route(const char *request, char *host, char *port, char *selector)
+{
+    const char  *colon, *slash;
+
+    /* host:port/selector */
+    colon = strchr(request, ':');
+    slash = colon ? strchr(colon, '/') : NULL;
+    if (colon && slash && colon > request && slash > colon + 1 &&
+            strspn(colon + 1, "0123456789") == slash - colon - 1 &&
+            ! memchr(request, '\t', slash - request)) {
+        snprintf(host, 512, "%.*s", (int) (colon - request), request);
+        snprintf(port, 64, "%.*s", (int) (slash - colon - 1), colon + 1);
+        snprintf(selector, 1024, "%s", slash + 1);
+        /* don't relay to anything but gopher servers */
+        if (! proxy_port_allowed(host, port)) {
+            if (check_option_true(config.verbose))
+                printf("deny %s\n", request);
+            return 0;
+        }
+        return 1;
+    }
+    /* everything else goes to the configured upstream */
+    if (! proxy_upstream_host[0])
+        return 0;
+    snprintf(host, 512, "%s", proxy_upstream_host);
+    snprintf(port, 64, "%s", proxy_upstream_port);
+    snprintf(selector, 1024, "%s", request);
     return 1;
 }
 
-int main(int argc, char *argv[])
+void *proxy_resolver(void *arg)
+{
+    proxy_dns_t     *dns = arg;
+    struct addrinfo hints;
+    struct addrinfo *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(dns->name, dns->port, &hints, &res) == 0) {
+        if (getnameinfo(res->ai_addr, res->ai_addrlen, dns->addr, sizeof(dns->addr),
+                    NULL, 0, NI_NUMERICHOST) != 0)
+            dns->addr[0] = 0;
+        freeaddrinfo(res);
+    }
+    write(dns->fd, &dns, sizeof(dns));
+    return NULL;
+}
+
+proxy_host_t *proxy_resolve(const char *host, const char *port)
+{
+    proxy_host_t    *h, *slot = NULL;
+    proxy_dns_t     *dns;
+    pthread_t       thread;
+    long            now = cgo_now_ms();
+    int             i;
+
+    for (i = 0; i < PROXY_MAX_HOSTS; i++) {
+        h = &proxy_hosts[i];
+        if (! strcmp(h->host, host) && ! strcmp(h->port, port)) {
+            if (h->resolving || h->expires > now)
+                return h;
+            slot = h;   /* stale */
+            break;
+        }
+        if (! h->resolving && (! slot || h->expires < slot->expires))
+            slot = h;
+    }
+    if (! slot)
+        return NULL;    /* too many slow lookups at once */
+    /* resolve in a thread, a slow DNS server must not stall other clients */
+    dns = calloc(1, sizeof(proxy_dns_t));
+    dns->host = slot;
+    dns->fd = proxy_dns_fds[1];
+    snprintf(dns->name, sizeof(dns->name), "%s", host);
+    snprintf(dns->port, sizeof(dns->port), "%s", port);
+    if (pthread_create(&thread, NULL, proxy_resolver, dns) != 0) {
+        free(dns);
+        return NULL;
+    }
+    pthread_detach(thread);
+    snprintf(slot->host, sizeof(slot->host), "%s", host);
+    snprintf(slot->port, sizeof(slot->port), "%s", port);
+    slot->addr[0] = 0;
+    slot->resolving = 1;
+    return slot;
+}
+
+void proxy_resolved(proxy_entry_t **pending, int num_pending)
+{
+    proxy_dns_t     *dns;
+    proxy_host_t    *h;
+    const char      *selector;
+    int             i;
+
+    while (read(proxy_dns_fds[0], &dns, sizeof(dns)) == sizeof(dns)) {
+        h = dns->host;
+        snprintf(h->addr, sizeof(h->addr), "%s", dns->addr);
+        h->resolving = 0;
+        h->expires = h->addr[0] ? cgo_now_ms() + PROXY_DNS_TTL : 0;
+        if (! h->addr[0] && check_option_true(config.verbose))
+            printf("(cannot resolve %s)\n", h->host);
+        for (i = 0; i < num_pending; i++) {
+            if (pending[i]->resolving != h)
+                continue;
+            pending[i]->resolving = NULL;
+            /* the key is host:port/selector */
+            selector = pending[i]->key + strlen(h->host) + strlen(h->port) + 2;
+            if (h->addr[0])
+                cgo_fetch_start(&ctx, &pending[i]->fetch, h->addr, h->port, selector,
+                        PROXY_TIMEOUT);
+            else
+                pending[i]->fetch.state = CGO_FETCH_FAILED;
+        }
+        free(dns);
+    }
+}
+
+unsigned int proxy_bucket(const char *key)
+{
+    return hash_bytes(key, strlen(key)) % PROXY_BUCKETS;
+}
+
+void proxy_detach(proxy_entry_t *e)
+{
+    proxy_entry_t   **prev;
+
+    if (! e->cached)
+        return;
+    for (prev = &proxy_cache[proxy_bucket(e->key)]; *prev != e; prev = &(*prev)->next) ;
+    *prev = e->next;
+    e->cached = 0;
+    if (e->fetch.state == CGO_FETCH_DONE)
+        proxy_cache_size -= e->fetch.len;
+}
+
+void proxy_release(proxy_entry_t *e)
+{
+    if (e->refs > 0)
+        e->refs--;
+    if (e->cached || e->refs > 0 || e->fetch.state < CGO_FETCH_DONE)
+        return;
+    cgo_fetch_close(&e->fetch);
+    free(e->key);
+    free(e);
+}
+
+void proxy_evict(long max_size)
+{
+    proxy_entry_t   *e, *oldest;
+    int             i;
+
+    while (proxy_cache_size > max_size) {
+        oldest = NULL;
+        for (i = 0; i < PROXY_BUCKETS; i++)
+            for (e = proxy_cache[i]; e; e = e->next)
+                if (e->fetch.state == CGO_FETCH_DONE && (! oldest || e->used < oldest->used))
+                    oldest = e;
+        if (! oldest)
+            return;
+        proxy_detach(oldest);
+        oldest->refs++;
+        proxy_release(oldest);
+    }
+}
+
+proxy_entry_t *proxy_lookup(const char *key)
+{
+    proxy_entry_t   *e;
+    long            now = cgo_now_ms();
+
+    for (e = proxy_cache[proxy_bucket(key)]; e; e = e->next) {
+        if (strcmp(e->key, key))
+            continue;
+        if (e->fetch.state == CGO_FETCH_DONE && e->expires <= now) {
+            proxy_detach(e);    /* stale */
+            e->refs++;
+            proxy_release(e);
+            return NULL;
+        }
+        e->used = now;
+        return e;
+    }
+    return NULL;
+}
+
+proxy_entry_t *proxy_request(const char *request, proxy_entry_t **pending,
+        int *num_pending)
+{
+    char            host[512], port[64], selector[1024], key[1600];
+    proxy_entry_t   *e;
+    proxy_host_t    *h;
+    unsigned int    bucket;
+
+    if (! proxy_route(request, host, port, selector))
+        return NULL;
+    snprintf(key, sizeof(key), "%s:%s/%s", host, port, selector);
+    e = proxy_lookup(key);
+    if (e) {
+        if (check_option_true(config.verbose))
+            printf("%s %s\n", e->fetch.state == CGO_FETCH_DONE ? "hit " : "join", key);
+        e->refs++;
+        return e;
+    }
+    if (*num_pending == PROXY_MAX_CLIENTS)
+        return NULL;
+    if (check_option_true(config.verbose))
+        printf("miss %s\n", key);
+    e = calloc(1, sizeof(proxy_entry_t));
+    e->key = strdup(key);
+    e->used = cgo_now_ms();
+    e->refs = 1;
+    h = proxy_resolve(host, port);
+    if (! h) {
+        e->fetch.fd = -1;
+        e->fetch.state = CGO_FETCH_FAILED;
+    } else if (h->resolving) {
+        e->fetch.fd = -1;
+        e->fetch.state = CGO_FETCH_CONNECTING;
+        e->fetch.started = e->used;
+        e->fetch.deadline = e->used + PROXY_TIMEOUT;
+        e->resolving = h;
+    } else {
+        cgo_fetch_start(&ctx, &e->fetch, h->addr, port, selector, PROXY_TIMEOUT);
+    }
+    if (e->fetch.state == CGO_FETCH_FAILED)
+        return e;   /* not cached, error goes to this client only */
+    bucket = proxy_bucket(key);
+    e->next = proxy_cache[bucket];
+    proxy_cache[bucket] = e;
+    e->cached = 1;
+    pending[(*num_pending)++] = e;
+    return e;
+}
+
+void proxy_finish(proxy_entry_t *e)
 {
+    long    ttl = atol(config.proxy_ttl) * 1000L;
+
+    if (! e->cached) {
+        e->refs++;      /* passed through, nothing to keep */
+        proxy_release(e);
+        return;
+    }
+    if (e->fetch.state == CGO_FETCH_DONE)
+        proxy_cache_size += e->fetch.len;
+    if (e->fetch.state != CGO_FETCH_DONE || ttl <= 0 || e->fetch.len > PROXY_MAX_ENTRY) {
+        proxy_detach(e);    /* don't keep failures or huge files */
+        e->refs++;
+        proxy_release(e);
+        return;
+    }
+    e->expires = cgo_now_ms() + ttl;
+    proxy_evict(atol(config.proxy_cache) * 1024L);
+}
+
+void proxy_stream(proxy_entry_t *e, proxy_client_t *clients)
+{
+    size_t  keep = e->base + e->fetch.len;
     int     i;
-    char    line[1024], *uri;
+
+    /* too big to cache: only keep what a client still has to get */
+    if (e->cached) {
+        if (check_option_true(config.verbose))
+            printf("pass %s\n", e->key);
+        proxy_detach(e);
+    }
+    for (i = 0; i < PROXY_MAX_CLIENTS; i++)
+        if (clients[i].fd != -1 && clients[i].entry == e && clients[i].sent < keep)
+            keep = clients[i].sent;
+    memmove(e->fetch.data, e->fetch.data + (keep - e->base), e->base + e->fetch.len - keep);
+    e->fetch.len -= keep - e->base;
+    e->base = keep;
+    if (e->refs == 0) {
+        /* nobody is listening anymore */
+        cgo_fetch_close(&e->fetch);
+        e->fetch.state = CGO_FETCH_FAILED;
+    }
+}
+
+void proxy_drop_client(proxy_client_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    if (c->entry)
+        proxy_release(c->entry);
+    c->entry = NULL;
+}
+
+void proxy_serve_client(proxy_client_t *c, short revents, proxy_entry_t **pending,
+        int *num_pending)
+{
+    const char  *error = "3error: cannot fetch selector\terror\terror.host\t1\r\n.\r\n";
+    ssize_t     len;
+    char        *nl;
+
+    if (! c->entry) {
+        /* still reading the request line */
+        if (revents) {
+            len = read(c->fd, c->request + c->len, sizeof(c->request) - c->len - 1);
+            if (len <= 0) {
+                proxy_drop_client(c);
+                return;
+            }
+            c->len += len;
+            c->request[c->len] = 0;
+        }
+        nl = strchr(c->request, '\n');
+        if (! nl) {
+            if (c->len == sizeof(c->request) - 1 || cgo_now_ms() > c->deadline)
+                proxy_drop_client(c);
+            return;
+        }
+        *nl = 0;
+        if (nl > c->request && nl[-1] == '\r')
+            nl[-1] = 0;
+        c->entry = proxy_request(c->request, pending, num_pending);
+        if (! c->entry) {
+            write(c->fd, error, strlen(error));
+            proxy_drop_client(c);
+            return;
+        }
+    }
+    /* pass on whatever arrived from upstream */
+    if (c->sent < c->entry->base + c->entry->fetch.len) {
+        len = write(c->fd, c->entry->fetch.data + (c->sent - c->entry->base),
+                c->entry->base + c->entry->fetch.len - c->sent);
+        if (len > 0)
+            c->sent += len;
+        else if (len == -1 && errno != EAGAIN && errno != EINTR) {
+            proxy_drop_client(c);
+            return;
+        }
+    }
+    /* done, don't wait for the next poll timeout */
+    if (c->sent == c->entry->base + c->entry->fetch.len &&
+            c->entry->fetch.state >= CGO_FETCH_DONE) {
+        if (c->entry->fetch.state == CGO_FETCH_FAILED && c->sent == 0)
+            write(c->fd, error, strlen(error));
+        proxy_drop_client(c);
+    } else if (revents & (POLLHUP | POLLERR)) {
+        proxy_drop_client(c);
+    }
+}
+
+void proxy(const char *addr)
+{
+    proxy_client_t  clients[PROXY_MAX_CLIENTS];
+    proxy_entry_t   *pending[PROXY_MAX_CLIENTS];
+    struct pollfd   pfds[2 + PROXY_MAX_CLIENTS * 2];
+    int             listener, fd, i, j, num_pending = 0, num_clients = 0;
+    short           revents;
+
+    listener = proxy_listen(addr);
+    if (listener == -1)
+        return;
+    if (pipe(proxy_dns_fds) == -1) {
+        fprintf(stderr, "error: cannot create pipe: %s\n", strerror(errno));
+        close(listener);
+        return;
+    }
+    fcntl(proxy_dns_fds[0], F_SETFL, fcntl(proxy_dns_fds[0], F_GETFL) | O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);
+    cgo_set_proxy(&ctx, NULL);  /* never proxy our own upstream requests */
+    memset(clients, 0, sizeof(clients));
+    for (i = 0; i < PROXY_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("(serving gopher on %s)\n", addr);
+    for (;;) {
+        /* listener, clients, upstream fetches */
+        pfds[0].fd = num_clients < PROXY_MAX_CLIENTS ? listener : -1;
+        pfds[0].events = POLLIN;
+        for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+            pfds[1 + i].fd = clients[i].fd;
+            pfds[1 + i].events = ! clients[i].entry ? POLLIN :
+                clients[i].sent < clients[i].entry->base + clients[i].entry->fetch.len ?
+                POLLOUT : 0;
+        }
+        for (i = 0; i < num_pending; i++) {
+            cgo_fetch_pollfd(&pending[i]->fetch, &pfds[1 + PROXY_MAX_CLIENTS + i]);
+            /* wait for slow clients before reading more */
+            if (pending[i]->fetch.len >= PROXY_MAX_ENTRY)
+                pfds[1 + PROXY_MAX_CLIENTS + i].fd = -1;
+        }
+        pfds[1 + PROXY_MAX_CLIENTS + num_pending].fd = proxy_dns_fds[0];
+        pfds[1 + PROXY_MAX_CLIENTS + num_pending].events = POLLIN;
+        if (poll(pfds, 2 + PROXY_MAX_CLIENTS + num_pending, 1000) == -1 && errno != EINTR)
+            break;
+        if (pfds[1 + PROXY_MAX_CLIENTS + num_pending].revents)
+            proxy_resolved(pending, num_pending);
+        /* new clients */
+        if (pfds[0].revents && (fd = accept(listener, NULL, NULL)) != -1) {
+            for (i = 0; clients[i].fd != -1; i++) ;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            memset(&clients[i], 0, sizeof(proxy_client_t));
+            clients[i].fd = fd;
+            clients[i].deadline = cgo_now_ms() + PROXY_TIMEOUT;
+            num_clients++;
+        }
+        /* upstream data */
+        for (i = 0, j = 0; i < num_pending; i++) {
+            revents = pfds[1 + PROXY_MAX_CLIENTS + i].revents;
+            if (pending[i]->fetch.len >= PROXY_MAX_ENTRY || ! pending[i]->cached)
+                proxy_stream(pending[i], clients);
+            /* only time out idle servers, not ones waiting for clients */
+            if (pfds[1 + PROXY_MAX_CLIENTS + i].fd == -1 && ! pending[i]->resolving)
+                pending[i]->fetch.deadline = cgo_now_ms() + PROXY_TIMEOUT;
+            cgo_fetch_handle(&pending[i]->fetch, revents);
+            if (revents)
+                pending[i]->fetch.deadline = cgo_now_ms() + PROXY_TIMEOUT;
+            if (pending[i]->fetch.state >= CGO_FETCH_DONE)
+                proxy_finish(pending[i]);
+            else
+                pending[j++] = pending[i];
+        }
+        num_pending = j;
+        /* answer clients */
+        for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+            if (clients[i].fd == -1)
+                continue;
+            proxy_serve_client(&clients[i], pfds[1 + i].revents, pending, &num_pending);
+            if (clients[i].fd == -1)
+                num_clients--;
+        }
+    }
+    close(listener);
+}
+
+int main(int argc, char *argv[])
+{
+    int         i, watch_mode = 0;
+    char        line[1024], *uri, *archive_file = NULL, root_uri[1700];
+    cgo_uri_t   root;
 
     /* copy defaults */
     init_config();
@@ -786,6 +2789,19 @@ int main(int argc, char *argv[])
             case 'v':
                 banner(stdout);
                 exit(EXIT_SUCCESS);
+            case 'w':
+                if (++i >= argc) usage();
+                snprintf(config.watchlist, sizeof(config.watchlist), "%s", argv[i]);
+                watch_mode = 1;
+                break;
+            case 'P':
+                if (++i >= argc) usage();
+                proxy(argv[i]);
+                exit(EXIT_FAILURE);
+            case 'A':
+                if (++i >= argc) usage();
+                archive_file = argv[i];
+                break;
             default:
                 usage();
         } else {
@@ -793,6 +2809,25 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* just watch the watchlist */
+    if (watch_mode) {
+        watch(1);
+        return EXIT_SUCCESS;
+    }
+
+    /* browse an archive instead of the network */
+    if (archive_file) {
+        if (! cgo_archive_open(&ctx, &archive, archive_file)) {
+            fprintf(stderr, "error: %s\n", ctx.error);
+            exit(EXIT_FAILURE);
+        }
+        if (uri == &config.start_uri[0] && cgo_archive_root(&archive, &root)) {
+            snprintf(root_uri, sizeof(root_uri), "gopher://%s:%s/1%s",
+                    root.host, root.port, root.selector);
+            uri = root_uri;
+        }
+    }
+
     /* parse uri */
     if (! parse_uri(uri)) {
         banner(stderr);
@@ -801,12 +2836,12 @@ int main(int argc, char *argv[])
     }
 
     /* main loop */
+    snprintf(tabs[0].name, sizeof(tabs[0].name), "main");
     view_directory(parsed_host, parsed_port, parsed_selector, 0);
     for (;;) {
-        printf("\033[%sm%s:%s%s\033[0m ", config.color_prompt,
-                current_host, current_port, current_selector);
-        fflush(stdout); /* to display the prompt */
-        if (! read_line(0, line, sizeof(line))) {
+        print_prompt();
+        warm_up();
+        if (! read_prompt(line, sizeof(line))) {
             puts("QUIT");
             return EXIT_SUCCESS;
         }
@@ -823,6 +2858,14 @@ int main(int argc, char *argv[])
                     "G[URI]     - jump to the given gopher URI\n"
                     "B          - show bookmarks\n"
                     "B[LINK]    - jump to the specified bookmark item\n"
+                    "S[QUERY]   - query all configured search servers\n"
+                    "W          - show changes in the watchlist\n"
+                    "M[TYPES]   - fetch all images (or TYPES) and show them at once\n"
+                    "E[FILE]    - export everything below this directory to FILE\n"
+                    "T          - show tabs\n"
+                    "T[TAB]     - switch to the tab with the given name or number\n"
+                    "T[TAB] URI - load URI (or a LINK) into TAB in the background\n"
+                    "T-[TAB]    - close the given tab\n"
                     "C^d        - quit");
                 break;
             case '<':
@@ -845,6 +2888,60 @@ int main(int argc, char *argv[])
             case 'B':
                 if (i == 1 || i == 3 || i == 4) view_bookmarks(make_key(line[1], line[2], line[3]));
                 break;
+            case 'S':
+                if (archive.map) {
+                    puts("(not available offline)");
+                    break;
+                }
+                for (uri = &line[1]; *uri == ' '; uri++) ;
+                if (! *uri) {
+                    printf("enter search string: ");
+                    fflush(stdout);
+                    if (! read_line(0, &line[1], sizeof(line) - 1))
+                        break;
+                    uri = &line[1];
+                }
+                view_search_group(uri);
+                break;
+            case 'W':
+                if (archive.map) {
+                    puts("(not available offline)");
+                    break;
+                }
+                watch(0);
+                break;
+            case 'M':
+                view_bulk(&line[1]);
+                break;
+            case 'E':
+                for (uri = &line[1]; *uri == ' '; uri++) ;
+                if (! *uri) {
+                    printf("enter archive filename: ");
+                    fflush(stdout);
+                    if (! read_line(0, &line[1], sizeof(line) - 1) || ! line[1])
+                        break;
+                    uri = &line[1];
+                }
+                export_archive(uri);
+                break;
+            case 'T':
+                if (i == 1) {
+                    view_tabs();
+                    break;
+                }
+                if (line[1] == '-') {
+                    tab_close(&line[2]);
+                    break;
+                }
+                for (uri = &line[1]; *uri && *uri != ' '; uri++) ;
+                if (*uri) {
+                    for (*uri++ = 0; *uri == ' '; uri++) ;
+                    tab_open(&line[1], uri);
+                } else if ((i = tab_find(&line[1])) != -1)
+                    tab_switch(i);
+                else
+                    puts("tab not found");
+                break;
             default:
                 follow_link(make_key(line[0], line[1], line[2]));
                 break;
@@ -0,0 +1,136 @@
+/*
+ * menus - fetch many gopher menus at once with libcgo
+ * Copyright (c) 2019 Sebastian Steinhauer <s.steinhauer@yahoo.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libcgo.h"
+
+/*
+ * Reads gopher URIs from stdin (one per line), fetches them with -j
+ * threads and prints how many items every menu has.
+ */
+
+#define MAX_THREADS 256
+
+typedef struct job_s job_t;
+struct job_s {
+    char    **uris;
+    int     num_uris, next;
+    int     timeout;    /* ms, see cgo_ctx_t */
+    long    menus, failed, items, links;
+    pthread_mutex_t lock;
+};
+
+typedef struct count_s count_t;
+struct count_s {
+    long    items, links;
+};
+
+void count_item(void *user, const cgo_item_t *item)
+{
+    count_t *count = user;
+
+    count->items++;
+    if (item->type != 'i' && item->type != '3' && item->host && item->port)
+        count->links++;
+}
+
+void *worker(void *arg)
+{
+    job_t       *job = arg;
+    cgo_ctx_t   ctx;
+    cgo_uri_t   uri;
+    count_t     count;
+    int         i, n;
+
+    cgo_init(&ctx);
+    ctx.timeout = job->timeout;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next < job->num_uris ? job->next++ : -1;
+        pthread_mutex_unlock(&job->lock);
+        if (i == -1)
+            return NULL;
+        memset(&count, 0, sizeof(count));
+        if (! cgo_parse_uri(job->uris[i], &uri))
+            n = -1;
+        else
+            n = cgo_fetch_menu(&ctx, uri.host, uri.port, uri.selector, count_item, &count);
+        if (n == -1)
+            fprintf(stderr, "%s: %s\n", job->uris[i], ctx.error);
+        else
+            printf("%s\t%ld items\t%ld links\n", job->uris[i], count.items, count.links);
+        pthread_mutex_lock(&job->lock);
+        job->menus++;
+        job->failed += n == -1;
+        job->items += count.items;
+        job->links += count.links;
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t   threads[MAX_THREADS];
+    job_t       job;
+    char        line[1024];
+    int         i, num_threads = sysconf(_SC_NPROCESSORS_ONLN) * 4, cap = 0;
+    int         timeout = CGO_TIMEOUT;
+    long        started;
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 < argc && ! strcmp(argv[i], "-j"))
+            num_threads = atoi(argv[++i]);
+        else if (i + 1 < argc && ! strcmp(argv[i], "-t"))
+            timeout = atoi(argv[++i]) * 1000;
+        else {
+            fputs("usage: menus [-j threads] [-t seconds] < uris\n", stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    memset(&job, 0, sizeof(job));
+    job.timeout = timeout;
+    pthread_mutex_init(&job.lock, NULL);
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (! line[0])
+            continue;
+        if (job.num_uris == cap) {
+            cap = cap ? cap * 2 : 256;
+            job.uris = realloc(job.uris, cap * sizeof(char*));
+        }
+        job.uris[job.num_uris++] = strdup(line);
+    }
+
+    started = cgo_now_ms();
+    for (i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, worker, &job);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    fprintf(stderr, "%ld menus (%ld failed), %ld items, %ld links in %ld ms with %d threads\n",
+            job.menus, job.failed, job.items, job.links, cgo_now_ms() - started, num_threads);
+
+    for (i = 0; i < job.num_uris; i++)
+        free(job.uris[i]);
+    free(job.uris);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1017 @@
+/*
+ * libcgo - the fetch and parse parts of cgo as a library
+ * Copyright (c) 2019 Sebastian Steinhauer <s.steinhauer@yahoo.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libcgo.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    0       /* SO_NOSIGPIPE is set on the socket instead */
+#endif
+
+void cgo_init(cgo_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(cgo_ctx_t));
+    ctx->timeout = CGO_TIMEOUT;
+}
+
+int cgo_set_proxy(cgo_ctx_t *ctx, const char *uri)
+{
+    cgo_uri_t   parsed;
+
+    ctx->proxy_host[0] = ctx->proxy_port[0] = 0;
+    if (! uri || ! *uri)
+        return 1;
+    if (! cgo_parse_uri(uri, &parsed)) {
+        snprintf(ctx->error, sizeof(ctx->error), "invalid proxy URI: %s", uri);
+        return 0;
+    }
+    snprintf(ctx->proxy_host, sizeof(ctx->proxy_host), "%s", parsed.host);
+    snprintf(ctx->proxy_port, sizeof(ctx->proxy_port), "%s", parsed.port);
+    return 1;
+}
+
+const char *cgo_route(const cgo_ctx_t *ctx, const char **host, const char **port,
+        const char *selector, char *buf, size_t buf_len)
+{
+    if (! ctx->proxy_host[0])
+        return selector;
+    /* the proxy expects host:port/selector */
+    if (buf)
+        snprintf(buf, buf_len, "%s:%s/%s", *host, *port, selector);
+    *host = ctx->proxy_host;
+    *port = ctx->proxy_port;
+    return buf;
+}
+
+/* a closed peer must not kill the embedding process with SIGPIPE */
+static int new_socket(const struct addrinfo *r)
+{
+    int     fd;
+#ifdef SO_NOSIGPIPE
+    int     on = 1;
+#endif
+
+    fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+#ifdef SO_NOSIGPIPE
+    if (fd != -1)
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+/* strerror() may share its buffer between threads */
+static const char *error_string(int err, char *buf, size_t buf_len)
+{
+    if (strerror_r(err, buf, buf_len) != 0)
+        snprintf(buf, buf_len, "error %d", err);
+    return buf;
+}
+
+static void set_timeouts(int fd, int timeout)
+{
+    struct timeval  tv;
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* connect() that gives up after timeout ms, leaves the socket blocking */
+static int connect_timeout(int fd, const struct sockaddr *addr, socklen_t addr_len,
+        int timeout)
+{
+    struct pollfd   pfd;
+    int             flags = fcntl(fd, F_GETFL), err = 0;
+    socklen_t       err_len = sizeof(err);
+
+    if (timeout <= 0)
+        return connect(fd, addr, addr_len);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(fd, addr, addr_len) == -1) {
+        if (errno != EINPROGRESS)
+            return -1;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout) != 1 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err)
+            return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+    set_timeouts(fd, timeout);
+    return 0;
+}
+
+int cgo_connect(cgo_ctx_t *ctx, const char *host, const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *r;
+    int             srv = -1, rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rc = getaddrinfo(host, port, &hints, &res)) != 0) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot resolve hostname '%s:%s': %s",
+                host, port, gai_strerror(rc));
+        return -1;
+    }
+    for (r = res; r; r = r->ai_next) {
+        srv = new_socket(r);
+        if (srv == -1)
+            continue;
+        if (connect_timeout(srv, r->ai_addr, r->ai_addrlen, ctx->timeout) == 0)
+            break;
+        close(srv);
+    }
+    freeaddrinfo(res);
+    if (! r) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot connect to host '%s:%s'",
+                host, port);
+        return -1;
+    }
+    return srv;
+}
+
+int cgo_request(cgo_ctx_t *ctx, int fd, const char *selector)
+{
+    char    request[1200];
+    int     l;
+
+    snprintf(request, sizeof(request), "%s\r\n", selector);
+    l = strlen(request);
+    if (ctx->timeout > 0)
+        set_timeouts(fd, ctx->timeout);     /* may come from elsewhere */
+    if (send(fd, request, l, MSG_NOSIGNAL) != l) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot complete request");
+        return 0;
+    }
+    return 1;
+}
+
+int cgo_dial(cgo_ctx_t *ctx, const char *host, const char *port, const char *selector)
+{
+    int     srv;
+    char    routed[1100];
+
+    selector = cgo_route(ctx, &host, &port, selector, routed, sizeof(routed));
+    srv = cgo_connect(ctx, host, port);
+    if (srv == -1)
+        return -1;
+    if (! cgo_request(ctx, srv, selector)) {
+        close(srv);
+        return -1;
+    }
+    return srv;
+}
+
+int cgo_fetch(cgo_ctx_t *ctx, const char *host, const char *port,
+        const char *selector, cgo_data_cb cb, void *user)
+{
+    int     srv;
+    ssize_t len;
+    char    buffer[4096], reason[128];
+
+    srv = cgo_dial(ctx, host, port, selector);
+    if (srv == -1)
+        return 0;
+    while ((len = read(srv, buffer, sizeof(buffer))) > 0)
+        if (! cb(user, buffer, len))
+            break;
+    close(srv);
+    if (len < 0) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot read from '%s:%s': %s",
+                host, port, errno == EAGAIN || errno == EWOULDBLOCK ?
+                "timed out" : error_string(errno, reason, sizeof(reason)));
+        return 0;
+    }
+    return 1;
+}
+
+int cgo_fetch_menu(cgo_ctx_t *ctx, const char *host, const char *port,
+        const char *selector, cgo_item_cb cb, void *user)
+{
+    cgo_reader_t    r;
+    cgo_item_t      item;
+    char            line[1024];
+    int             srv, count = 0;
+
+    srv = cgo_dial(ctx, host, port, selector);
+    if (srv == -1)
+        return -1;
+    cgo_reader_init(&r, srv);
+    cgo_reader_head(&r);
+    if (r.failed) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot read from '%s:%s'",
+                host, port);
+        close(srv);
+        return -1;
+    }
+    if (cgo_sniff(r.buf, r.len) != CGO_SNIFF_MENU) {
+        snprintf(ctx->error, sizeof(ctx->error), "not a directory");
+        close(srv);
+        return -1;
+    }
+    while (cgo_reader_line(&r, line, sizeof(line)) && strcmp(line, ".")) {
+        cgo_parse_item(line, &item);
+        cb(user, &item);
+        count++;
+    }
+    close(srv);
+    if (r.failed) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot read from '%s:%s'",
+                host, port);
+        return -1;
+    }
+    return count;
+}
+
+long cgo_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+int cgo_dial_start(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *r;
+    int             srv = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (r = res; r; r = r->ai_next) {
+        srv = new_socket(r);
+        if (srv == -1)
+            continue;
+        fcntl(srv, F_SETFL, fcntl(srv, F_GETFL) | O_NONBLOCK);
+        if (connect(srv, r->ai_addr, r->ai_addrlen) == 0 || errno == EINPROGRESS)
+            break;
+        close(srv);
+    }
+    freeaddrinfo(res);
+    return r ? srv : -1;
+}
+
+int cgo_fetch_start(cgo_ctx_t *ctx, cgo_fetch_t *f, const char *host,
+        const char *port, const char *selector, long timeout)
+{
+    char    routed[1100];
+
+    selector = cgo_route(ctx, &host, &port, selector, routed, sizeof(routed));
+    memset(f, 0, sizeof(cgo_fetch_t));
+    f->started = cgo_now_ms();
+    f->deadline = timeout > 0 ? f->started + timeout : 0;
+    snprintf(f->request, sizeof(f->request), "%s\r\n", selector);
+    f->request_len = strlen(f->request);
+    f->fd = cgo_dial_start(host, port);
+    f->state = f->fd == -1 ? CGO_FETCH_FAILED : CGO_FETCH_CONNECTING;
+    return f->fd != -1;
+}
+
+void cgo_fetch_close(cgo_fetch_t *f)
+{
+    if (f->fd != -1)
+        close(f->fd);
+    f->fd = -1;
+    free(f->data);
+    f->data = NULL;
+    f->len = f->cap = f->used = 0;
+}
+
+void cgo_fetch_pollfd(cgo_fetch_t *f, struct pollfd *pfd)
+{
+    pfd->fd = f->state < CGO_FETCH_DONE ? f->fd : -1;
+    pfd->events = f->state == CGO_FETCH_CONNECTING ? POLLOUT : POLLIN;
+    pfd->revents = 0;
+}
+
+void cgo_fetch_handle(cgo_fetch_t *f, short revents)
+{
+    int         err = 0;
+    socklen_t   err_len = sizeof(err);
+    ssize_t     len;
+
+    if (f->state >= CGO_FETCH_DONE)
+        return;
+    if (f->state == CGO_FETCH_CONNECTING && revents) {
+        getsockopt(f->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err || send(f->fd, f->request, f->request_len, MSG_NOSIGNAL) != f->request_len)
+            f->state = CGO_FETCH_FAILED;
+        else
+            f->state = CGO_FETCH_READING;
+    } else if (f->state == CGO_FETCH_READING && revents) {
+        if (f->cap - f->len < 4096) {
+            f->cap = f->cap ? f->cap * 2 : 16384;
+            f->data = realloc(f->data, f->cap);
+        }
+        len = read(f->fd, f->data + f->len, f->cap - f->len - 1);
+        if (len > 0) {
+            if (! f->first_byte)
+                f->first_byte = cgo_now_ms();
+            f->len += len;
+            f->data[f->len] = 0;
+        } else if (len == 0) {
+            f->state = CGO_FETCH_DONE;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            f->state = CGO_FETCH_FAILED;
+        }
+    }
+    if (f->idle && revents)
+        f->deadline = cgo_now_ms() + f->idle;
+    if (f->state < CGO_FETCH_DONE && f->deadline && cgo_now_ms() >= f->deadline)
+        f->state = CGO_FETCH_FAILED;
+    if (f->state >= CGO_FETCH_DONE) {
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+int cgo_fetch_wait(cgo_fetch_t **fetches, int n, int timeout)
+{
+    struct pollfd   pfds[n];
+    int             i, active = 0;
+    long            now = cgo_now_ms(), left;
+
+    for (i = 0; i < n; i++) {
+        cgo_fetch_pollfd(fetches[i], &pfds[i]);
+        if (pfds[i].fd == -1)
+            continue;
+        active++;
+        if (fetches[i]->deadline) {
+            left = fetches[i]->deadline - now;
+            if (left < 0) left = 0;
+            if (timeout < 0 || left < timeout) timeout = left;
+        }
+    }
+    if (! active)
+        return 0;
+    if (poll(pfds, n, timeout) == -1 && errno != EINTR)
+        return -1;
+    for (active = 0, i = 0; i < n; i++) {
+        cgo_fetch_handle(fetches[i], pfds[i].revents);
+        if (fetches[i]->state < CGO_FETCH_DONE)
+            active++;
+    }
+    return active;
+}
+
+int cgo_fetch_line(cgo_fetch_t *f, char *buf, size_t buf_len)
+{
+    char    *nl;
+    size_t  i, l;
+
+    if (f->used >= f->len)
+        return 0;
+    nl = memchr(f->data + f->used, '\n', f->len - f->used);
+    if (! nl) {
+        if (f->state != CGO_FETCH_DONE)
+            return 0;   /* wait for the rest of the line */
+        nl = f->data + f->len;
+    }
+    l = nl - (f->data + f->used);
+    for (i = 0; l > 0 && i < buf_len - 1; l--, f->used++)
+        if (f->data[f->used] != '\r')
+            buf[i++] = f->data[f->used];
+    buf[i] = 0;
+    f->used = nl - f->data + (nl < f->data + f->len ? 1 : 0);
+    return 1;
+}
+
+void cgo_reader_init(cgo_reader_t *r, int fd)
+{
+    r->fd = fd;
+    r->buf = r->local;
+    r->pos = r->len = 0;
+    r->failed = 0;
+    r->cap = sizeof(r->local);
+}
+
+int cgo_reader_fill(cgo_reader_t *r)
+{
+    ssize_t len;
+
+    if (r->fd == -1)
+        return 0;
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    if (r->len == r->cap)
+        return 0;
+    len = read(r->fd, r->buf + r->len, r->cap - r->len);
+    if (len < 0)
+        r->failed = 1;
+    if (len <= 0)
+        return 0;
+    r->len += len;
+    return 1;
+}
+
+int cgo_reader_line(cgo_reader_t *r, char *buf, size_t buf_len)
+{
+    char    *nl;
+    size_t  i = 0;
+
+    while (! (nl = memchr(r->buf + r->pos, '\n', r->len - r->pos))) {
+        if (r->len - r->pos == r->cap || ! cgo_reader_fill(r))
+            break;
+    }
+    if (r->pos == r->len)
+        return 0;
+    if (! nl)
+        nl = r->buf + r->len - 1;   /* last line or overlong line */
+    for (; r->buf + r->pos <= nl; r->pos++)
+        if (r->buf[r->pos] != '\r' && r->buf[r->pos] != '\n' && i < buf_len - 1)
+            buf[i++] = r->buf[r->pos];
+    buf[i] = '\0';
+    return 1;
+}
+
+int cgo_reader_head(cgo_reader_t *r)
+{
+    char    *p;
+    int     i;
+
+    /* read until the first lines are complete */
+    do {
+        for (i = 0, p = r->buf; i < CGO_HEAD_CHECK_LEN &&
+                (p = memchr(p, '\n', r->len - (p - r->buf))); i++, p++) ;
+    } while (i < CGO_HEAD_CHECK_LEN && cgo_reader_fill(r));
+    return r->len > 0;
+}
+
+int cgo_parse_uri(const char *uri, cgo_uri_t *out)
+{
+    int     i;
+
+    /* strip gopher:// */
+    if (! strncmp(uri, "gopher://", 9))
+        uri += 9;
+    /* parse host */
+    for (i = 0; *uri && *uri != ':' && *uri != '/'; uri++) {
+        if (*uri != ' ' && i < sizeof(out->host) - 1)
+            out->host[i++] = *uri;
+    }
+    if (i > 0) out->host[i] = 0;
+    else return 0;
+    /* parse port */
+    if (*uri == ':') {
+        uri++;
+        for (i = 0; *uri && *uri != '/'; uri++)
+            if (*uri != ' ' && i < sizeof(out->port) - 1)
+                out->port[i++] = *uri;
+        out->port[i] = 0;
+    } else snprintf(out->port, sizeof(out->port), "%d", 70);
+    /* parse selector (skip slash and selector type) */
+    out->type = '1';
+    if (*uri) ++uri;
+    if (*uri) out->type = *uri++;
+    for (i = 0; *uri && i < sizeof(out->selector) - 1; ++uri, ++i)
+        out->selector[i] = *uri;
+    out->selector[i] = '\0';
+
+    return 1;
+}
+
+int cgo_is_item(const char *line)
+{
+    switch (line[0]) {
+        case 'i':
+        case '3':
+        case '.':   /* some gopher servers use this */
+        case '0':
+        case '1':
+        case '5':
+        case '7':
+        case '8':
+        case '9':
+        case 'g':
+        case 'I':
+        case 'p':
+        case 'h':
+        case 's':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void cgo_split_item(char *line, char *fields[4])
+{
+    int     i;
+    char    *lp, *last;
+
+    for (i = 0; i < 4; i++)
+        fields[i] = NULL;
+    last = &line[1];
+    for (lp = last, i = 0; i < 4; lp++) {
+        if (*lp == '\t' || *lp == '\0') {
+            fields[i] = last;
+            last = lp + 1;
+            if (*lp == '\0')
+                break;
+            *lp = '\0';
+            i++;
+        }
+    }
+}
+
+int cgo_parse_item(char *line, cgo_item_t *item)
+{
+    char    *fields[4];
+
+    cgo_split_item(line, fields);
+    item->type = line[0];
+    item->name = fields[0];
+    item->selector = fields[1];
+    item->host = fields[2];
+    item->port = fields[3];
+    return cgo_is_item(line);
+}
+
+int cgo_sniff(const char *data, size_t len)
+{
+    size_t      i, j, end, lines, tabs, tabbed, ctrl = 0;
+    const char  *nl;
+
+    /* the first lines look like directory entries */
+    for (i = 0, lines = 0, tabbed = 0; i < len && lines < CGO_HEAD_CHECK_LEN; lines++) {
+        if (! cgo_is_item(data + i))
+            break;
+        nl = memchr(data + i, '\n', len - i);
+        end = nl ? (size_t) (nl - data) : len;
+        /* name, selector and host - only info lines are often sloppy */
+        for (j = i, tabs = 0; j < end; j++)
+            tabs += data[j] == '\t';
+        if (tabs >= 2)
+            tabbed++;
+        else if (nl && ! strchr("i3.", data[i]))
+            break;      /* the last line may just be cut off */
+        i = nl ? end + 1 : len;
+    }
+    if ((i >= len || lines == CGO_HEAD_CHECK_LEN) && tabbed)
+        return CGO_SNIFF_MENU;
+    /* well-known magic numbers */
+    if ((len >= 4 && ! memcmp(data, "\x89PNG", 4)) ||
+            (len >= 4 && ! memcmp(data, "GIF8", 4)) ||
+            (len >= 3 && ! memcmp(data, "\xff\xd8\xff", 3)) ||
+            (len >= 12 && ! memcmp(data, "RIFF", 4) && ! memcmp(data + 8, "WEBP", 4)))
+        return CGO_SNIFF_IMAGE;
+    if ((len >= 3 && ! memcmp(data, "ID3", 3)) ||
+            (len >= 4 && ! memcmp(data, "OggS", 4)) ||
+            (len >= 4 && ! memcmp(data, "fLaC", 4)) ||
+            (len >= 12 && ! memcmp(data, "RIFF", 4) && ! memcmp(data + 8, "WAVE", 4)))
+        return CGO_SNIFF_SOUND;
+    /* text has no NULs and hardly any control characters */
+    for (i = 0; i < len; i++) {
+        if (data[i] == 0)
+            return CGO_SNIFF_BINARY;
+        if ((unsigned char) data[i] < 32 && ! strchr("\t\r\n\f\033", data[i]))
+            ctrl++;
+    }
+    return ctrl * 32 > len ? CGO_SNIFF_BINARY : CGO_SNIFF_TEXT;
+}
+
+void cgo_reader_memory(cgo_reader_t *r, const char *data, size_t len)
+{
+    r->fd = -1;
+    r->buf = (char*) data;  /* never written, cgo_reader_fill() stops at fd -1 */
+    r->pos = 0;
+    r->len = r->cap = len;
+    r->failed = 0;
+}
+
+/* archive layout, all numbers little-endian */
+#define ARCHIVE_MAGIC       "CGOA"
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_HEADER_LEN  40
+#define ARCHIVE_ENTRY_LEN   32
+
+static void put_u32(char *p, unsigned long v)
+{
+    int     i;
+
+    for (i = 0; i < 4; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+static void put_u64(char *p, unsigned long long v)
+{
+    int     i;
+
+    for (i = 0; i < 8; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+static unsigned long get_u32(const char *p)
+{
+    unsigned long   v = 0;
+    int             i;
+
+    for (i = 3; i >= 0; i--)
+        v = (v << 8) | (unsigned char) p[i];
+    return v;
+}
+
+static unsigned long long get_u64(const char *p)
+{
+    unsigned long long  v = 0;
+    int                 i;
+
+    for (i = 7; i >= 0; i--)
+        v = (v << 8) | (unsigned char) p[i];
+    return v;
+}
+
+static size_t archive_key(char *key, size_t key_len, const char *host,
+        const char *port, const char *selector)
+{
+    int     l;
+
+    l = snprintf(key, key_len, "%s\t%s\t%s", host, port, selector);
+    return l < 0 ? 0 : (size_t) l < key_len ? (size_t) l : key_len - 1;
+}
+
+static int compare_key(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int     c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    return c ? c : a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int compare_entry(const void *a, const void *b)
+{
+    const cgo_archive_entry_t   *x = a, *y = b;
+
+    return compare_key(x->key, x->key_len, y->key, y->key_len);
+}
+
+int cgo_archive_open(cgo_ctx_t *ctx, cgo_archive_t *a, const char *filename)
+{
+    struct stat         st;
+    unsigned long long  index_off;
+    void                *map;
+
+    memset(a, 0, sizeof(cgo_archive_t));
+    a->fd = open(filename, O_RDONLY);
+    if (a->fd == -1 || fstat(a->fd, &st) == -1) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot open archive '%s'", filename);
+        if (a->fd != -1) close(a->fd);
+        return 0;
+    }
+    a->size = st.st_size;
+    map = a->size >= ARCHIVE_HEADER_LEN ?
+        mmap(NULL, a->size, PROT_READ, MAP_SHARED, a->fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot map archive '%s'", filename);
+        close(a->fd);
+        return 0;
+    }
+    a->map = map;
+    /* only the header is checked, so opening doesn't depend on the size */
+    index_off = get_u64(a->map + 8);
+    a->count = get_u64(a->map + 16);
+    if (memcmp(a->map, ARCHIVE_MAGIC, 4) || get_u32(a->map + 4) != ARCHIVE_VERSION ||
+            index_off > a->size || a->count > (a->size - index_off) / ARCHIVE_ENTRY_LEN) {
+        snprintf(ctx->error, sizeof(ctx->error), "'%s' is not a cgo archive", filename);
+        cgo_archive_close(a);
+        return 0;
+    }
+    a->index = a->map + index_off;
+    return 1;
+}
+
+void cgo_archive_close(cgo_archive_t *a)
+{
+    if (a->map)
+        munmap((void*) a->map, a->size);
+    if (a->fd != -1)
+        close(a->fd);
+    memset(a, 0, sizeof(cgo_archive_t));
+    a->fd = -1;
+}
+
+static const char *archive_find(const cgo_archive_t *a, const char *key, size_t key_len)
+{
+    unsigned long long  lo = 0, hi = a->count, mid, off, len;
+    const char          *e;
+    int                 c;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        e = a->index + mid * ARCHIVE_ENTRY_LEN;
+        off = get_u64(e);
+        len = get_u32(e + 24);
+        if (off > a->size || len > a->size - off)
+            return NULL;    /* broken archive */
+        c = compare_key(key, key_len, a->map + off, len);
+        if (c == 0)
+            return e;
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+int cgo_archive_lookup(const cgo_archive_t *a, const char *host, const char *port,
+        const char *selector, char *type, const char **data, size_t *len)
+{
+    char                key[1700];
+    const char          *e;
+    unsigned long long  off, l;
+
+    if (! a->map)
+        return 0;
+    e = archive_find(a, key, archive_key(key, sizeof(key), host, port, selector));
+    if (! e)
+        return 0;
+    off = get_u64(e + 8);
+    l = get_u64(e + 16);
+    if (off > a->size || l > a->size - off)
+        return 0;
+    if (type) *type = e[28];
+    *data = a->map + off;
+    *len = l;
+    return 1;
+}
+
+int cgo_archive_root(const cgo_archive_t *a, cgo_uri_t *out)
+{
+    unsigned long long  off = get_u64(a->map + 24);
+    unsigned long       len = get_u32(a->map + 32);
+    const char          *p, *end, *tab;
+
+    if (! len || off > a->size || len > a->size - off)
+        return 0;
+    p = a->map + off;
+    end = p + len;
+    if (! (tab = memchr(p, '\t', end - p)))
+        return 0;
+    snprintf(out->host, sizeof(out->host), "%.*s", (int) (tab - p), p);
+    p = tab + 1;
+    if (! (tab = memchr(p, '\t', end - p)))
+        return 0;
+    snprintf(out->port, sizeof(out->port), "%.*s", (int) (tab - p), p);
+    p = tab + 1;
+    snprintf(out->selector, sizeof(out->selector), "%.*s", (int) (end - p), p);
+    out->type = '1';
+    return 1;
+}
+
+static int archive_write(cgo_ctx_t *ctx, cgo_archive_writer_t *w,
+        const char *data, size_t len)
+{
+    ssize_t l;
+    char    reason[128];
+
+    while (len > 0) {
+        l = pwrite(w->fd, data, len, w->end);
+        if (l <= 0) {
+            snprintf(ctx->error, sizeof(ctx->error), "cannot write archive: %s",
+                    error_string(errno, reason, sizeof(reason)));
+            return 0;
+        }
+        w->end += l;
+        data += l;
+        len -= l;
+    }
+    return 1;
+}
+
+/* frees the keys that are not inside the old mapping */
+static void archive_abort(cgo_archive_writer_t *w)
+{
+    size_t  i;
+
+    for (i = 0; i < w->count; i++)
+        if (! w->old.map || w->entries[i].key < w->old.map ||
+                w->entries[i].key >= w->old.map + w->old.size)
+            free(w->entries[i].key);
+    free(w->entries);
+    free(w->slots);
+    if (w->old.map)
+        cgo_archive_close(&w->old);
+    if (w->fd != -1)
+        close(w->fd);
+    memset(w, 0, sizeof(cgo_archive_writer_t));
+    w->fd = -1;
+}
+
+int cgo_archive_begin(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *filename)
+{
+    char                header[ARCHIVE_HEADER_LEN];
+    const char          *e;
+    struct stat         st;
+    unsigned long long  i;
+    ssize_t             l, j = 0;
+
+    memset(w, 0, sizeof(cgo_archive_writer_t));
+    w->old.fd = -1;
+    w->fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (w->fd == -1 || fstat(w->fd, &st) == -1) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot open archive '%s'", filename);
+        archive_abort(w);
+        return 0;
+    }
+    /* an export that never got to its header left only zeros there */
+    l = st.st_size == 0 ? 0 : pread(w->fd, header, sizeof(header), 0);
+    while (j < l && ! header[j])
+        j++;
+    if (st.st_size == 0 || (l > 0 && j == l)) {
+        /* new archive, the real header follows in cgo_archive_commit() */
+        if (ftruncate(w->fd, 0) == -1) {
+            snprintf(ctx->error, sizeof(ctx->error), "cannot truncate archive '%s'", filename);
+            archive_abort(w);
+            return 0;
+        }
+        memset(header, 0, sizeof(header));
+        if (! archive_write(ctx, w, header, sizeof(header))) {
+            archive_abort(w);
+            return 0;
+        }
+        return 1;
+    }
+    /* appending: start from the old index */
+    if (! cgo_archive_open(ctx, &w->old, filename)) {
+        archive_abort(w);
+        return 0;
+    }
+    w->end = w->old.size;
+    w->cap = w->count = w->old_count = w->old.count;
+    w->entries = calloc(w->cap ? w->cap : 1, sizeof(cgo_archive_entry_t));
+    for (i = 0; i < w->old.count; i++) {
+        e = w->old.index + i * ARCHIVE_ENTRY_LEN;
+        w->entries[i].key_off = get_u64(e);
+        w->entries[i].data_off = get_u64(e + 8);
+        w->entries[i].data_len = get_u64(e + 16);
+        w->entries[i].key_len = get_u32(e + 24);
+        w->entries[i].type = e[28];
+        if (w->entries[i].key_off > w->old.size ||
+                w->entries[i].key_len > w->old.size - w->entries[i].key_off) {
+            snprintf(ctx->error, sizeof(ctx->error), "'%s' is broken", filename);
+            w->count = 0;
+            archive_abort(w);
+            return 0;
+        }
+        w->entries[i].key = (char*) w->old.map + w->entries[i].key_off;
+    }
+    return 1;
+}
+
+/* the slot of key among the new entries: holds its index + 1, or 0 */
+static size_t *archive_slot(cgo_archive_writer_t *w, const char *key, size_t key_len)
+{
+    unsigned long long  h = 14695981039346656037ULL;    /* FNV-1a */
+    size_t              i, *slot;
+    cgo_archive_entry_t *e;
+
+    for (i = 0; i < key_len; i++)
+        h = (h ^ (unsigned char) key[i]) * 1099511628211ULL;
+    for (i = h & (w->num_slots - 1); ; i = (i + 1) & (w->num_slots - 1)) {
+        slot = &w->slots[i];
+        if (! *slot)
+            return slot;
+        e = &w->entries[*slot - 1];
+        if (! compare_key(key, key_len, e->key, e->key_len))
+            return slot;
+    }
+}
+
+static void archive_grow_slots(cgo_archive_writer_t *w)
+{
+    size_t  i;
+
+    free(w->slots);
+    w->num_slots = w->num_slots ? w->num_slots * 2 : 256;
+    w->slots = calloc(w->num_slots, sizeof(size_t));
+    for (i = w->old_count; i < w->count; i++)
+        *archive_slot(w, w->entries[i].key, w->entries[i].key_len) = i + 1;
+}
+
+int cgo_archive_add(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *host,
+        const char *port, const char *selector, char type, const char *data, size_t len)
+{
+    char                key[1700];
+    cgo_archive_entry_t find, *e = NULL;
+    size_t              *slot;
+
+    find.key = key;
+    find.key_len = archive_key(key, sizeof(key), host, port, selector);
+    if (w->old_count > 0)
+        e = bsearch(&find, w->entries, w->old_count, sizeof(cgo_archive_entry_t),
+                compare_entry);
+    if (e && e->data_len == len && e->data_off + len <= w->old.size &&
+            ! memcmp(w->old.map + e->data_off, data, len)) {
+        e->type = type;
+        return 1;   /* unchanged, keep the old payload */
+    }
+    if (! e) {
+        /* added before in this session: replace it */
+        if ((w->count - w->old_count + 1) * 2 > w->num_slots)
+            archive_grow_slots(w);
+        slot = archive_slot(w, key, find.key_len);
+        if (*slot)
+            e = &w->entries[*slot - 1];
+    }
+    if (! e) {
+        if (w->count == w->cap) {
+            w->cap = w->cap ? w->cap * 2 : 256;
+            w->entries = realloc(w->entries, w->cap * sizeof(cgo_archive_entry_t));
+        }
+        e = &w->entries[w->count++];
+        memset(e, 0, sizeof(cgo_archive_entry_t));
+        e->key = malloc(find.key_len);
+        memcpy(e->key, key, find.key_len);
+        e->key_len = find.key_len;
+        *slot = w->count;
+    }
+    e->type = type;
+    e->data_off = w->end;
+    e->data_len = len;
+    return archive_write(ctx, w, data, len);
+}
+
+int cgo_archive_commit(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *host,
+        const char *port, const char *selector)
+{
+    char                header[ARCHIVE_HEADER_LEN], entry[ARCHIVE_ENTRY_LEN];
+    char                root[1700], reason[128];
+    cgo_archive_entry_t *e;
+    unsigned long long  index_off, root_off;
+    size_t              i, root_len;
+    int                 ok = 1;
+
+    /* new keys and the root, then the merged index, then the header */
+    for (i = w->old_count; ok && i < w->count; i++) {
+        w->entries[i].key_off = w->end;
+        ok = archive_write(ctx, w, w->entries[i].key, w->entries[i].key_len);
+    }
+    root_len = archive_key(root, sizeof(root), host, port, selector);
+    root_off = w->end;
+    ok = ok && archive_write(ctx, w, root, root_len);
+    qsort(w->entries, w->count, sizeof(cgo_archive_entry_t), compare_entry);
+    index_off = w->end;
+    for (i = 0; ok && i < w->count; i++) {
+        e = &w->entries[i];
+        memset(entry, 0, sizeof(entry));
+        put_u64(entry, e->key_off);
+        put_u64(entry + 8, e->data_off);
+        put_u64(entry + 16, e->data_len);
+        put_u32(entry + 24, e->key_len);
+        entry[28] = e->type;
+        ok = archive_write(ctx, w, entry, sizeof(entry));
+    }
+    if (ok && fsync(w->fd) != 0) {
+        snprintf(ctx->error, sizeof(ctx->error), "cannot sync archive: %s",
+                error_string(errno, reason, sizeof(reason)));
+        ok = 0;
+    }
+    if (ok) {
+        /* readers see the new index only from here on */
+        memset(header, 0, sizeof(header));
+        memcpy(header, ARCHIVE_MAGIC, 4);
+        put_u32(header + 4, ARCHIVE_VERSION);
+        put_u64(header + 8, index_off);
+        put_u64(header + 16, w->count);
+        put_u64(header + 24, root_off);
+        put_u32(header + 32, root_len);
+        ok = pwrite(w->fd, header, sizeof(header), 0) == sizeof(header) && fsync(w->fd) == 0;
+        if (! ok)
+            snprintf(ctx->error, sizeof(ctx->error), "cannot write archive header");
+    }
+    archive_abort(w);
+    return ok;
+}
@@ -0,0 +1,176 @@
+/*
+ * libcgo - the fetch and parse parts of cgo as a library
+ * Copyright (c) 2019 Sebastian Steinhauer <s.steinhauer@yahoo.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef LIBCGO_H
+#define LIBCGO_H
+
+#include <sys/types.h>
+#include <poll.h>
+
+/*
+ * Nothing in here touches global state: everything a call needs comes in
+ * through a cgo_ctx_t or the arguments, and results go out through return
+ * values and callbacks. Use one context per thread. A server closing the
+ * connection early never raises SIGPIPE.
+ */
+
+#define CGO_HEAD_CHECK_LEN  5
+#define CGO_TIMEOUT         30000   /* default of cgo_ctx_t.timeout */
+
+/* states of a non-blocking fetch */
+#define CGO_FETCH_CONNECTING    0
+#define CGO_FETCH_READING       1
+#define CGO_FETCH_DONE          2
+#define CGO_FETCH_FAILED        3
+
+/* what cgo_sniff() thinks a response is */
+#define CGO_SNIFF_MENU      0
+#define CGO_SNIFF_TEXT      1
+#define CGO_SNIFF_IMAGE     2
+#define CGO_SNIFF_SOUND     3
+#define CGO_SNIFF_BINARY    4
+
+typedef struct cgo_ctx_s cgo_ctx_t;
+struct cgo_ctx_s {
+    char    proxy_host[512], proxy_port[64];    /* empty: no proxy */
+    char    error[256];                         /* last error */
+    int     timeout;    /* ms for connecting and for each read or write, 0: none */
+};
+
+typedef struct cgo_uri_s cgo_uri_t;
+struct cgo_uri_s {
+    char    type;
+    char    host[512], port[64], selector[1024];
+};
+
+typedef struct cgo_item_s cgo_item_t;
+struct cgo_item_s {
+    char    type;
+    char    *name, *selector, *host, *port;     /* NULL if missing */
+};
+
+typedef struct cgo_reader_s cgo_reader_t;
+struct cgo_reader_s {
+    int     fd;
+    char    *buf;
+    size_t  pos, len, cap;
+    int     failed;     /* a read failed or timed out */
+    char    local[4096];
+};
+
+typedef struct cgo_fetch_s cgo_fetch_t;
+struct cgo_fetch_s {
+    int     fd;
+    int     state;
+    char    request[1200];
+    size_t  request_len;
+    char    *data;
+    size_t  len, cap, used;
+    long    started, deadline;
+    long    idle;           /* if set, activity moves the deadline this far on */
+    long    first_byte;     /* when the answer started, 0 before */
+};
+
+/* a read-only archive, see cgo_archive_open() */
+typedef struct cgo_archive_s cgo_archive_t;
+struct cgo_archive_s {
+    int                 fd;
+    const char          *map;
+    size_t              size;
+    unsigned long long  count;
+    const char          *index;
+};
+
+typedef struct cgo_archive_entry_s cgo_archive_entry_t;
+struct cgo_archive_entry_s {
+    char                *key;
+    size_t              key_len;
+    char                type;
+    unsigned long long  key_off, data_off, data_len;
+};
+
+/* collects entries for an archive, see cgo_archive_begin() */
+typedef struct cgo_archive_writer_s cgo_archive_writer_t;
+struct cgo_archive_writer_s {
+    int                 fd;
+    cgo_archive_t       old;
+    cgo_archive_entry_t *entries;
+    size_t              count, old_count, cap;
+    size_t              *slots, num_slots;      /* hash of the new entries */
+    unsigned long long  end;
+};
+
+/* called with every chunk of a response, return 0 to stop */
+typedef int (*cgo_data_cb)(void *user, const char *data, size_t len);
+/* called with every line of a menu */
+typedef void (*cgo_item_cb)(void *user, const cgo_item_t *item);
+
+/* context */
+void cgo_init(cgo_ctx_t *ctx);
+int cgo_set_proxy(cgo_ctx_t *ctx, const char *uri);
+const char *cgo_route(const cgo_ctx_t *ctx, const char **host, const char **port,
+        const char *selector, char *buf, size_t buf_len);
+
+/* blocking fetches */
+int cgo_connect(cgo_ctx_t *ctx, const char *host, const char *port);
+int cgo_request(cgo_ctx_t *ctx, int fd, const char *selector);
+int cgo_dial(cgo_ctx_t *ctx, const char *host, const char *port, const char *selector);
+int cgo_fetch(cgo_ctx_t *ctx, const char *host, const char *port,
+        const char *selector, cgo_data_cb cb, void *user);
+int cgo_fetch_menu(cgo_ctx_t *ctx, const char *host, const char *port,
+        const char *selector, cgo_item_cb cb, void *user);
+
+/* non-blocking fetches */
+long cgo_now_ms();
+int cgo_dial_start(const char *host, const char *port);
+int cgo_fetch_start(cgo_ctx_t *ctx, cgo_fetch_t *f, const char *host,
+        const char *port, const char *selector, long timeout);
+void cgo_fetch_close(cgo_fetch_t *f);
+void cgo_fetch_pollfd(cgo_fetch_t *f, struct pollfd *pfd);
+void cgo_fetch_handle(cgo_fetch_t *f, short revents);
+int cgo_fetch_wait(cgo_fetch_t **fetches, int n, int timeout);
+int cgo_fetch_line(cgo_fetch_t *f, char *buf, size_t buf_len);
+
+/* buffered reading */
+void cgo_reader_init(cgo_reader_t *r, int fd);
+void cgo_reader_memory(cgo_reader_t *r, const char *data, size_t len);
+int cgo_reader_fill(cgo_reader_t *r);
+int cgo_reader_head(cgo_reader_t *r);
+int cgo_reader_line(cgo_reader_t *r, char *buf, size_t buf_len);
+
+/* parsing */
+int cgo_parse_uri(const char *uri, cgo_uri_t *out);
+int cgo_is_item(const char *line);
+void cgo_split_item(char *line, char *fields[4]);
+int cgo_parse_item(char *line, cgo_item_t *item);
+int cgo_sniff(const char *data, size_t len);
+
+/*
+ * archives: a header, the payloads, and an index sorted by
+ * "host\tport\tselector" which is searched in place after mmap()
+ */
+int cgo_archive_open(cgo_ctx_t *ctx, cgo_archive_t *a, const char *filename);
+void cgo_archive_close(cgo_archive_t *a);
+int cgo_archive_lookup(const cgo_archive_t *a, const char *host, const char *port,
+        const char *selector, char *type, const char **data, size_t *len);
+int cgo_archive_root(const cgo_archive_t *a, cgo_uri_t *out);
+int cgo_archive_begin(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *filename);
+int cgo_archive_add(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *host,
+        const char *port, const char *selector, char type, const char *data, size_t len);
+int cgo_archive_commit(cgo_ctx_t *ctx, cgo_archive_writer_t *w, const char *host,
+        const char *port, const char *selector);
+
+#endif